@@ -10,6 +10,45 @@ const ANDROID_TARGET_AARCH64_QUERY: std.Target.Query = .{
     .abi = .android,
 };
 
+// how rook and bishop attacks are looked up, see movegen.slider_lookup
+const SliderLookup = enum { auto, magic, pext, dispatch };
+
+// how the search makes moves, see board.make_mode
+const MakeMode = enum { copy, unmake };
+
+fn build_config(b: *std.Build) *std.Build.Step.Options {
+    const slider_lookup = b.option(
+        SliderLookup,
+        "slider_lookup",
+        "Slider attack lookup: auto (pext if the target has bmi2), magic, pext or dispatch (check cpuid at runtime)",
+    ) orelse .auto;
+
+    const make_mode = b.option(
+        MakeMode,
+        "make_mode",
+        "Move making: copy (copy the board for every child) or unmake (make in place and undo)",
+    ) orelse .copy;
+
+    const mailbox = b.option(
+        bool,
+        "mailbox",
+        "Keep a piece per square alongside the bitboards for constant time piece lookups",
+    ) orelse true;
+
+    const trace = b.option(
+        bool,
+        "trace",
+        "Compile in the search trace recorder (setoption name TraceFile value <path>)",
+    ) orelse false;
+
+    const config = b.addOptions();
+    config.addOption(SliderLookup, "slider_lookup", slider_lookup);
+    config.addOption(MakeMode, "make_mode", make_mode);
+    config.addOption(bool, "mailbox", mailbox);
+    config.addOption(bool, "trace", trace);
+    return config;
+}
+
 fn build_consts(b: *std.Build) std.Build.LazyPath {
     // generate the magics at build time
     const consts = b.addExecutable(.{
@@ -29,6 +68,7 @@ fn build_consts(b: *std.Build) std.Build.LazyPath {
 fn build_openings_builder(
     b: *std.Build,
     consts_out: std.Build.LazyPath,
+    config: *std.Build.Step.Options,
     optimize: std.builtin.OptimizeMode,
     target: std.Build.ResolvedTarget,
 ) void {
@@ -41,6 +81,7 @@ fn build_openings_builder(
     mod.addAnonymousImport("consts", .{
         .root_source_file = consts_out,
     });
+    mod.addOptions("config", config);
 
     const exe = b.addExecutable(.{ .name = "openings", .root_module = mod });
 
@@ -90,12 +131,43 @@ const exes = [_]ExeConfig{
         .step = "st",
         .desc = "Run strength testing",
     },
+    .{
+        .name = "crigd",
+        .root_src = "src/crigd.zig",
+        .step = "crigd",
+        .desc = "Serve many uci sessions over a unix socket",
+    },
+    .{
+        .name = "match",
+        .root_src = "src/match.zig",
+        .step = "match",
+        .desc = "Play two uci engines against each other with sprt",
+    },
+    .{
+        .name = "datagen",
+        .root_src = "src/datagen.zig",
+        .step = "datagen",
+        .desc = "Generate training positions from fixed node self-play",
+    },
+    .{
+        .name = "trace_analyzer",
+        .root_src = "src/trace_analyzer.zig",
+        .step = "trace",
+        .desc = "Summarise a search trace file (build the engine with -Dtrace=true to record one)",
+    },
+    .{
+        .name = "bench",
+        .root_src = "src/bench.zig",
+        .step = "bench",
+        .desc = "Benchmark slider lookups, move making, piece lookups and batch eval",
+    },
 };
 
 fn add_runnable_exe(
     b: *std.Build,
     exe_config: ExeConfig,
     consts_out: std.Build.LazyPath,
+    config: *std.Build.Step.Options,
     optimize: std.builtin.OptimizeMode,
     target: std.Build.ResolvedTarget,
 ) void {
@@ -108,6 +180,7 @@ fn add_runnable_exe(
     mod.addAnonymousImport("consts", .{
         .root_source_file = consts_out,
     });
+    mod.addOptions("config", config);
 
     const exe = b.addExecutable(.{ .name = exe_config.name, .root_module = mod });
     b.installArtifact(exe);
@@ -129,6 +202,7 @@ const LibConfig = struct {
 fn build_app_libs(
     b: *std.Build,
     consts_out: std.Build.LazyPath,
+    config: *std.Build.Step.Options,
     optimize: std.builtin.OptimizeMode,
 ) void {
     const ndk_sysroot = b.option([]const u8, "ndk_sysroot", "Path to NDK sysroot");
@@ -144,7 +218,7 @@ fn build_app_libs(
 
     const libapp_step = b.step("app", "Installs the android libraries");
     for (libconfs) |conf| {
-        const install_step = add_app_lib(b, consts_out, optimize, ndk_sysroot, android_min_sdk, conf);
+        const install_step = add_app_lib(b, consts_out, config, optimize, ndk_sysroot, android_min_sdk, conf);
         libapp_step.dependOn(&install_step.step);
     }
 }
@@ -152,6 +226,7 @@ fn build_app_libs(
 fn add_app_lib(
     b: *std.Build,
     consts_out: std.Build.LazyPath,
+    config: *std.Build.Step.Options,
     optimize: std.builtin.OptimizeMode,
     ndk_sysroot: ?[]const u8,
     min_sdk_ver: ?usize,
@@ -167,6 +242,7 @@ fn add_app_lib(
     });
     libapp_root.pic = true;
     libapp_root.addAnonymousImport("consts", .{ .root_source_file = consts_out });
+    libapp_root.addOptions("config", config);
     libapp_root.addIncludePath(b.path("include"));
 
     const libcrig = b.addLibrary(.{
@@ -213,12 +289,13 @@ pub fn build(b: *std.Build) void {
     const optimize = b.standardOptimizeOption(.{});
 
     const consts_out = build_consts(b);
+    const config = build_config(b);
 
-    build_openings_builder(b, consts_out, optimize, target);
+    build_openings_builder(b, consts_out, config, optimize, target);
 
     for (exes) |exe_config| {
-        add_runnable_exe(b, exe_config, consts_out, optimize, target);
+        add_runnable_exe(b, exe_config, consts_out, config, optimize, target);
     }
 
-    build_app_libs(b, consts_out, optimize);
+    build_app_libs(b, consts_out, config, optimize);
 }
@@ -2,10 +2,15 @@ const std = @import("std");
 const board = @import("board.zig");
 const uci = @import("uci.zig");
 const UCI = uci.UCI;
+const search = @import("search.zig");
+const Engine = @import("engine.zig").Engine;
+const tt = @import("tt.zig");
 const perft = @import("perft.zig");
+const review = @import("review.zig");
 // const PosixTimer = @import("timer.zig").PosixTimer;
 const ZigTimer = @import("timer.zig").ZigTimer;
 const util = @import("util.zig");
+const movegen = @import("movegen.zig");
 
 pub const std_options: std.Options = .{
     .page_size_min = 16384,
@@ -73,7 +78,23 @@ var androidLogWriter = std.Io.Writer{
 // };
 
 var arena = std.heap.ArenaAllocator.init(std.heap.page_allocator);
-const allocator = arena.allocator();
+// searches can run on their own threads, which log through this allocator
+var thread_safe_arena = std.heap.ThreadSafeAllocator{ .child_allocator = arena.allocator() };
+const allocator = thread_safe_arena.allocator();
+
+// each uci instance gets its own log writer, so that searches running on
+// different threads don't share a buffer
+fn new_android_log_writer() !*std.Io.Writer {
+    const buf = try allocator.alloc(u8, androidLogBuffer.len);
+    const w = try allocator.create(std.Io.Writer);
+    w.* = .{
+        .vtable = &androidLogVtable,
+        .buffer = buf,
+        .end = 0,
+    };
+
+    return w;
+}
 
 fn new_string(env: *C.JNIEnv, str: [:0]const u8) C.jstring {
     return env.*.*.NewStringUTF.?(env, str[0..str.len :0]);
@@ -110,21 +131,67 @@ fn throw_uci_exception(
     return env.*.*.ThrowNew.?(env, class, buf[0..msg.len :0]);
 }
 
+// each uci instance gets its own engine, so that they can search independently
 pub export fn Java_com_github_georgib0y_crigapp_UCI_initUci(env: *C.JNIEnv, this: C.jobject) callconv(.c) ?*UCI {
     _ = this;
-    return UCI.init(allocator, &androidLogWriter, board.default_board()) catch |err| {
+    const engine = Engine.init(std.heap.page_allocator, tt.DEFAULT_TT_MB) catch |err| {
+        _ = throw_uci_exception(env, err, "could not init engine");
+        return null;
+    };
+
+    const log_writer = new_android_log_writer() catch |err| {
+        engine.deinit();
+        _ = throw_uci_exception(env, err, "could not init uci log writer");
+        return null;
+    };
+
+    return UCI.init(allocator, log_writer, engine, board.default_board()) catch |err| {
+        engine.deinit();
         _ = throw_uci_exception(env, err, "could not init uci");
         return null;
     };
 }
 
+// throws if a search started by startSearch hasn't been awaited yet, it is
+// still using the instance's board
+fn search_running(env: *C.JNIEnv, uci_instance: *UCI) bool {
+    if (!uci_instance.searching.load(.acquire)) return false;
+    _ = throw_uci_exception(env, error.SearchInProgress, "await the running search first");
+    return true;
+}
+
+// claims the instance for a search or review, throws (returning false) if
+// one is already running. release with searching.store(false, .release)
+fn claim_instance(env: *C.JNIEnv, uci_instance: *UCI) bool {
+    if (uci_instance.searching.cmpxchgStrong(false, true, .acquire, .monotonic) == null) return true;
+    _ = throw_uci_exception(env, error.SearchInProgress, "await the running search first");
+    return false;
+}
+
+// frees an instance from initUci along with its engine, the instance can't
+// be used again afterwards
+pub export fn Java_com_github_georgib0y_crigapp_UCI_destroyUci(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    uci_instance: *UCI,
+) callconv(.c) void {
+    _ = this;
+    if (search_running(env, uci_instance)) return;
+
+    const log_writer = uci_instance.writer;
+    uci_instance.engine.deinit();
+    uci_instance.deinit(allocator);
+    allocator.free(log_writer.buffer);
+    allocator.destroy(log_writer);
+}
+
 pub export fn Java_com_github_georgib0y_crigapp_UCI_uciNewGame(
     env: *C.JNIEnv,
     this: C.jobject,
     uci_instance: *UCI,
 ) callconv(.c) void {
-    _ = env;
     _ = this;
+    if (search_running(env, uci_instance)) return;
     uci_instance.handle_ucinewgame();
 }
 
@@ -159,6 +226,9 @@ pub export fn Java_com_github_georgib0y_crigapp_UCI_searchPosition(
         return null;
     }
 
+    if (!claim_instance(env, uci_instance)) return null;
+    defer uci_instance.searching.store(false, .release);
+
     const pos_slice = get_string(env, pos_str);
     uci_instance.handle_position(pos_slice) catch |err| {
         _ = throw_uci_exception(env, err, "could not set position");
@@ -170,6 +240,10 @@ pub export fn Java_com_github_georgib0y_crigapp_UCI_searchPosition(
         return null;
     };
 
+    return best_move_string(env, uci_instance);
+}
+
+fn best_move_string(env: *C.JNIEnv, uci_instance: *UCI) C.jstring {
     var best_move: [100]u8 = undefined;
     var fixed = std.io.Writer.fixed(&best_move);
     // const writer = fbs.writer();
@@ -196,6 +270,325 @@ pub export fn Java_com_github_georgib0y_crigapp_UCI_searchPosition(
     // return new_string(env, "new string");
 }
 
+// Java side listener:
+//   void onInfo(int depth, int score, boolean isMate, long timeMs, long nodes, long nps, String pv)
+//   void onBestMove(String move) -- move is null if the search failed
+const ON_INFO_SIG = "(IIZJJJLjava/lang/String;)V";
+const ON_BESTMOVE_SIG = "(Ljava/lang/String;)V";
+
+const AsyncSearch = struct {
+    uci: *UCI,
+    vm: [*c]C.JavaVM,
+    // global ref to the java listener
+    listener: C.jobject,
+    on_info: C.jmethodID,
+    on_bestmove: C.jmethodID,
+    limits: search.Limits,
+    thread: std.Thread,
+    // only valid on the search thread, once it has attached to the jvm
+    env: ?*C.JNIEnv,
+};
+
+fn clear_pending_exception(env: *C.JNIEnv) void {
+    if (env.*.*.ExceptionCheck.?(env) != 0) {
+        env.*.*.ExceptionDescribe.?(env);
+        env.*.*.ExceptionClear.?(env);
+    }
+}
+
+fn on_info_jni(ctx: *anyopaque, info: *const uci.SearchInfo) void {
+    const job: *AsyncSearch = @ptrCast(@alignCast(ctx));
+    const env = job.env orelse return;
+
+    var pv_buf: [2048]u8 = undefined;
+    var fixed = std.Io.Writer.fixed(pv_buf[0 .. pv_buf.len - 1]);
+    info.pv.write_pv(&fixed) catch {};
+    pv_buf[fixed.buffered().len] = 0;
+
+    const pv_str = env.*.*.NewStringUTF.?(env, &pv_buf);
+    defer env.*.*.DeleteLocalRef.?(env, pv_str);
+
+    const args = [_]C.jvalue{
+        .{ .i = @intCast(info.depth) },
+        .{ .i = info.mate orelse info.score },
+        .{ .z = @intFromBool(info.mate != null) },
+        .{ .j = @intCast(info.time_ms) },
+        .{ .j = @intCast(info.nodes) },
+        .{ .j = @intCast(info.nps) },
+        .{ .l = pv_str },
+    };
+
+    env.*.*.CallVoidMethodA.?(env, job.listener, job.on_info, &args);
+    clear_pending_exception(env);
+}
+
+fn async_search_worker(job: *AsyncSearch) void {
+    var worker_env: [*c]C.JNIEnv = null;
+    if (job.vm.*.*.AttachCurrentThread.?(job.vm, &worker_env, null) != C.JNI_OK) {
+        std.log.err("could not attach search thread to the jvm", .{});
+        return;
+    }
+    defer _ = job.vm.*.*.DetachCurrentThread.?(job.vm);
+
+    const env: *C.JNIEnv = @ptrCast(worker_env);
+    job.env = env;
+
+    job.uci.info_listener = .{ .ctx = job, .on_info = on_info_jni };
+    defer job.uci.info_listener = null;
+
+    var bm_str: C.jstring = null;
+    if (job.uci.search_and_report(job.limits)) {
+        bm_str = best_move_string(env, job.uci);
+        clear_pending_exception(env);
+    } else |err| {
+        std.log.err("async search failed: {s}", .{@errorName(err)});
+    }
+
+    const args = [_]C.jvalue{.{ .l = bm_str }};
+    env.*.*.CallVoidMethodA.?(env, job.listener, job.on_bestmove, &args);
+    clear_pending_exception(env);
+}
+
+// starts searching position on a new native thread and returns a handle to
+// the search, info and the bestmove are delivered to listener as they arrive.
+// movetime_ms and nodes <= 0 use the default budget. awaitSearch must be
+// called on the handle to free it, and before another search is started on
+// the same instance
+pub export fn Java_com_github_georgib0y_crigapp_UCI_startSearch(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    uci_instance: *UCI,
+    pos_str: C.jstring,
+    movetime_ms: C.jlong,
+    nodes: C.jlong,
+    listener: C.jobject,
+) callconv(.c) ?*AsyncSearch {
+    _ = this;
+
+    if (pos_str == null) {
+        _ = throw_uci_exception(env, error.NullPosStr, null);
+        return null;
+    }
+
+    if (listener == null) {
+        _ = throw_uci_exception(env, error.NullListener, null);
+        return null;
+    }
+
+    // the previous job's thread could still be searching the board
+    if (!claim_instance(env, uci_instance)) return null;
+    var spawned = false;
+    defer if (!spawned) uci_instance.searching.store(false, .release);
+
+    uci_instance.handle_position(get_string(env, pos_str)) catch |err| {
+        _ = throw_uci_exception(env, err, "could not set position");
+        return null;
+    };
+
+    var vm: [*c]C.JavaVM = null;
+    if (env.*.*.GetJavaVM.?(env, &vm) != C.JNI_OK) {
+        _ = throw_uci_exception(env, error.NoJavaVM, null);
+        return null;
+    }
+
+    // GetMethodID leaves a NoSuchMethodError pending if it fails
+    const class = env.*.*.GetObjectClass.?(env, listener);
+    const on_info = env.*.*.GetMethodID.?(env, class, "onInfo", ON_INFO_SIG) orelse return null;
+    const on_bestmove = env.*.*.GetMethodID.?(env, class, "onBestMove", ON_BESTMOVE_SIG) orelse return null;
+
+    const job = std.heap.page_allocator.create(AsyncSearch) catch |err| {
+        _ = throw_uci_exception(env, err, "could not allocate search");
+        return null;
+    };
+
+    job.* = .{
+        .uci = uci_instance,
+        .vm = vm,
+        .listener = env.*.*.NewGlobalRef.?(env, listener),
+        .on_info = on_info,
+        .on_bestmove = on_bestmove,
+        .limits = .{
+            .movetime_ms = if (movetime_ms > 0) @intCast(movetime_ms) else search.TIMEOUT_MS,
+            .nodes = if (nodes > 0) @as(usize, @intCast(nodes)) else null,
+        },
+        .thread = undefined,
+        .env = null,
+    };
+
+    uci_instance.engine.stop.store(false, .monotonic);
+    uci_instance.last_best_move = null;
+    job.thread = std.Thread.spawn(.{}, async_search_worker, .{job}) catch |err| {
+        env.*.*.DeleteGlobalRef.?(env, job.listener);
+        std.heap.page_allocator.destroy(job);
+        _ = throw_uci_exception(env, err, "could not spawn search thread");
+        return null;
+    };
+    spawned = true;
+
+    return job;
+}
+
+// asks the search to finish, the best move found so far is still reported
+pub export fn Java_com_github_georgib0y_crigapp_UCI_stopSearch(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    handle: *AsyncSearch,
+) callconv(.c) void {
+    _ = env;
+    _ = this;
+    handle.uci.engine.stop.store(true, .monotonic);
+}
+
+// blocks until the search has finished, frees the handle and returns the
+// best move (or null if the search failed)
+pub export fn Java_com_github_georgib0y_crigapp_UCI_awaitSearch(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    handle: *AsyncSearch,
+) callconv(.c) C.jstring {
+    _ = this;
+
+    handle.thread.join();
+    const uci_instance = handle.uci;
+    uci_instance.searching.store(false, .release);
+
+    env.*.*.DeleteGlobalRef.?(env, handle.listener);
+    std.heap.page_allocator.destroy(handle);
+
+    if (uci_instance.last_best_move == null) return null;
+    return best_move_string(env, uci_instance);
+}
+
+// Java side:
+//   PlyAnalysis(int score, boolean isMate, String bestMove, String pv)
+//     score is the mate in moves when isMate, negative for the side being
+//     mated and 0 if it is already checkmated
+//   ReviewListener.onProgress(int done, int total)
+const PLY_ANALYSIS_CLASS = "com/github/georgib0y/crigapp/PlyAnalysis";
+const PLY_ANALYSIS_CTOR_SIG = "(IZLjava/lang/String;Ljava/lang/String;)V";
+const ON_PROGRESS_SIG = "(II)V";
+
+const ReviewProgress = struct {
+    env: *C.JNIEnv,
+    listener: C.jobject,
+    on_progress: C.jmethodID,
+};
+
+fn on_progress_jni(ctx: *anyopaque, done: usize, total: usize) void {
+    const p: *ReviewProgress = @ptrCast(@alignCast(ctx));
+    const args = [_]C.jvalue{ .{ .i = @intCast(done) }, .{ .i = @intCast(total) } };
+    p.env.*.*.CallVoidMethodA.?(p.env, p.listener, p.on_progress, &args);
+    clear_pending_exception(p.env);
+}
+
+fn ply_analysis(env: *C.JNIEnv, class: C.jclass, ctor: C.jmethodID, r: *const review.PlyReview) C.jobject {
+    var bm_buf: [16]u8 = undefined;
+    var bm = std.Io.Writer.fixed(bm_buf[0 .. bm_buf.len - 1]);
+    if (!movegen.moves_eq(r.best_move, movegen.Move.NONE)) r.best_move.as_uci_str(&bm) catch {};
+    bm_buf[bm.buffered().len] = 0;
+
+    var pv_buf: [2048]u8 = undefined;
+    var pv = std.Io.Writer.fixed(pv_buf[0 .. pv_buf.len - 1]);
+    r.pv.write_pv(&pv) catch {};
+    pv_buf[pv.buffered().len] = 0;
+
+    const bm_str = env.*.*.NewStringUTF.?(env, &bm_buf);
+    defer env.*.*.DeleteLocalRef.?(env, bm_str);
+    const pv_str = env.*.*.NewStringUTF.?(env, &pv_buf);
+    defer env.*.*.DeleteLocalRef.?(env, pv_str);
+
+    const mate = uci.mate_from_score(r.score);
+    if (mate) |m| std.debug.assert((m > 0) == (r.score > 0));
+    const args = [_]C.jvalue{
+        .{ .i = mate orelse r.score },
+        .{ .z = @intFromBool(mate != null) },
+        .{ .l = bm_str },
+        .{ .l = pv_str },
+    };
+    return env.*.*.NewObjectA.?(env, class, ctor, &args);
+}
+
+// analyses every position of the game in pos_str (a uci position command),
+// last to first with the tt kept warm between them, and returns a
+// PlyAnalysis per position (the final position included). movetime_ms and
+// nodes <= 0 use the default budget for each position. listener may be null,
+// stopReview on the same uci instance (from another thread) ends the review
+// early
+pub export fn Java_com_github_georgib0y_crigapp_UCI_analyzeGame(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    uci_instance: *UCI,
+    pos_str: C.jstring,
+    movetime_ms: C.jlong,
+    nodes: C.jlong,
+    listener: C.jobject,
+) callconv(.c) C.jobjectArray {
+    _ = this;
+
+    if (pos_str == null) {
+        _ = throw_uci_exception(env, error.NullPosStr, null);
+        return null;
+    }
+
+    // held for the whole review, startSearch mustn't touch the board under it
+    if (!claim_instance(env, uci_instance)) return null;
+    defer uci_instance.searching.store(false, .release);
+
+    // FindClass and GetMethodID leave an exception pending if they fail
+    const class = env.*.*.FindClass.?(env, PLY_ANALYSIS_CLASS) orelse return null;
+    const ctor = env.*.*.GetMethodID.?(env, class, "<init>", PLY_ANALYSIS_CTOR_SIG) orelse return null;
+
+    var progress: ReviewProgress = undefined;
+    var listener_arg: ?review.ProgressListener = null;
+    if (listener != null) {
+        const listener_class = env.*.*.GetObjectClass.?(env, listener);
+        progress = .{
+            .env = env,
+            .listener = listener,
+            .on_progress = env.*.*.GetMethodID.?(env, listener_class, "onProgress", ON_PROGRESS_SIG) orelse return null,
+        };
+        listener_arg = .{ .ctx = &progress, .on_progress = on_progress_jni };
+    }
+
+    const limits = search.Limits{
+        .movetime_ms = if (movetime_ms > 0) @intCast(movetime_ms) else search.TIMEOUT_MS,
+        .nodes = if (nodes > 0) @as(usize, @intCast(nodes)) else null,
+    };
+
+    uci_instance.engine.stop.store(false, .monotonic);
+    const reviews = review.review_game(
+        std.heap.page_allocator,
+        uci_instance,
+        get_string(env, pos_str),
+        limits,
+        listener_arg,
+    ) catch |err| {
+        _ = throw_uci_exception(env, err, "could not review game");
+        return null;
+    };
+    defer std.heap.page_allocator.free(reviews);
+
+    const array = env.*.*.NewObjectArray.?(env, @intCast(reviews.len), class, null) orelse return null;
+    for (reviews, 0..) |*r, i| {
+        const obj = ply_analysis(env, class, ctor, r) orelse return null;
+        env.*.*.SetObjectArrayElement.?(env, array, @intCast(i), obj);
+        env.*.*.DeleteLocalRef.?(env, obj);
+    }
+
+    return array;
+}
+
+// ends a running analyzeGame on uci_instance early, it throws ReviewStopped
+pub export fn Java_com_github_georgib0y_crigapp_UCI_stopReview(
+    env: *C.JNIEnv,
+    this: C.jobject,
+    uci_instance: *UCI,
+) callconv(.c) void {
+    _ = env;
+    _ = this;
+    uci_instance.engine.stop.store(true, .monotonic);
+}
+
 pub export fn Java_com_github_georgib0y_crigapp_UCI_logUciPosition(
     env: *C.JNIEnv,
     this: C.jobject,
@@ -203,17 +596,18 @@ pub export fn Java_com_github_georgib0y_crigapp_UCI_logUciPosition(
     pos_str: C.jstring,
 ) void {
     _ = this;
+    if (search_running(env, uci_instance)) return;
 
     uci_instance.handle_position(get_string(env, pos_str)) catch |err| {
         _ = throw_uci_exception(env, err, "could not set position for logging");
         return;
     };
 
-    util.display_board(uci_instance.board, &androidLogWriter) catch |err| {
+    util.display_board(uci_instance.board, uci_instance.writer) catch |err| {
         _ = throw_uci_exception(env, err, "failed to write uci board");
     };
 
-    androidLogWriter.flush() catch |err| {
+    uci_instance.writer.flush() catch |err| {
         _ = throw_uci_exception(env, err, "failed to flush uci board");
     };
 }
@@ -0,0 +1,185 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const BB = board.BB;
+const eval = @import("eval.zig");
+const tt = @import("tt.zig");
+
+// evaluates and hashes a whole block of positions at once, for tuning, data
+// generation and scoring services. the boards are stored structure of arrays
+// so that VEC_LEN of them are worked on in each vector lane, and the block
+// is split over every core. the results match eval.eval_board_full,
+// eval.board_score and tt.hash_board exactly
+
+pub const VEC_LEN = 8;
+
+const U64Vec = @Vector(VEC_LEN, BB);
+const I32Vec = @Vector(VEC_LEN, i32);
+const U8Vec = @Vector(VEC_LEN, u8);
+const BoolVec = @Vector(VEC_LEN, bool);
+
+// spawning a thread costs more than evaluating this many chunks
+const MIN_CHUNKS_PER_THREAD = 256;
+
+pub const Batch = struct {
+    arena: std.heap.ArenaAllocator,
+    len: usize,
+    // every array is padded to a whole number of VEC_LEN chunks, the
+    // padding is left as empty boards
+    cap: usize,
+
+    // pieces[p][i] is board i's bitboard for piece p
+    pieces: [12][]BB,
+    ctm: []u8,
+    castling: []u8,
+    ep: []u8,
+
+    // filled in by run
+    mg_val: []i32,
+    eg_val: []i32,
+    phase: []u8,
+    // tapered, from the side to move's point of view like eval.board_score
+    score: []i32,
+    hash: []u64,
+
+    pub fn init(allocator: std.mem.Allocator, len: usize) !Batch {
+        var arena = std.heap.ArenaAllocator.init(allocator);
+        errdefer arena.deinit();
+        const a = arena.allocator();
+
+        const cap = std.mem.alignForward(usize, len, VEC_LEN);
+        var pieces: [12][]BB = undefined;
+        for (&pieces) |*p| {
+            p.* = try a.alloc(BB, cap);
+            @memset(p.*, 0);
+        }
+
+        const ctm = try a.alloc(u8, cap);
+        const castling = try a.alloc(u8, cap);
+        const ep = try a.alloc(u8, cap);
+        @memset(ctm, 0);
+        @memset(castling, 0);
+        @memset(ep, 64);
+
+        return .{
+            .arena = arena,
+            .len = len,
+            .cap = cap,
+            .pieces = pieces,
+            .ctm = ctm,
+            .castling = castling,
+            .ep = ep,
+            .mg_val = try a.alloc(i32, cap),
+            .eg_val = try a.alloc(i32, cap),
+            .phase = try a.alloc(u8, cap),
+            .score = try a.alloc(i32, cap),
+            .hash = try a.alloc(u64, cap),
+        };
+    }
+
+    pub fn deinit(self: *Batch) void {
+        self.arena.deinit();
+    }
+
+    pub fn set(self: *Batch, i: usize, b: *const Board) void {
+        std.debug.assert(i < self.len);
+        for (self.pieces, b.pieces) |p, bb| p[i] = bb;
+        self.ctm[i] = @intFromEnum(b.ctm);
+        self.castling[i] = b.castling;
+        self.ep[i] = b.ep;
+    }
+
+    // evaluates and hashes every board on all cores
+    pub fn run(self: *Batch) !void {
+        try parallel_for(self.cap / VEC_LEN, self, run_chunks);
+    }
+
+    // evaluates and hashes every board on this thread
+    pub fn run_single(self: *Batch) void {
+        run_chunks(self, 0, self.cap / VEC_LEN);
+    }
+
+    fn run_chunks(self: *Batch, start: usize, end: usize) void {
+        for (start..end) |chunk| self.run_chunk(chunk * VEC_LEN);
+    }
+
+    // boards i to i + VEC_LEN, each square of each piece bitboard is tested
+    // in every lane at once and the pst and zobrist values for it selected
+    fn run_chunk(self: *Batch, i: usize) void {
+        const zero_i32: I32Vec = @splat(0);
+        const zero_u64: U64Vec = @splat(0);
+        const one: U64Vec = @splat(1);
+
+        var mg = zero_i32;
+        var eg = zero_i32;
+        var phase = zero_i32;
+        var hash = zero_u64;
+
+        for (self.pieces, 0..) |piece_bbs, p| {
+            const bbs: U64Vec = piece_bbs[i..][0..VEC_LEN].*;
+
+            const count: I32Vec = @intCast(@popCount(bbs));
+            mg += count * @as(I32Vec, @splat(eval.MAT_SCORES[p]));
+            eg += count * @as(I32Vec, @splat(eval.MAT_SCORES[p]));
+            phase += count * @as(I32Vec, @splat(eval.PIECE_PHASE_VAL[p]));
+
+            for (0..64) |sq| {
+                const shift: @Vector(VEC_LEN, u6) = @splat(@intCast(sq));
+                const on: BoolVec = (bbs >> shift) & one == one;
+                mg += @select(i32, on, @as(I32Vec, @splat(eval.MID_PST[p][sq])), zero_i32);
+                eg += @select(i32, on, @as(I32Vec, @splat(eval.END_PST[p][sq])), zero_i32);
+                hash ^= @select(u64, on, @as(U64Vec, @splat(tt.piece_zobrist(@enumFromInt(p), sq))), zero_u64);
+            }
+        }
+
+        const ctm: U8Vec = self.ctm[i..][0..VEC_LEN].*;
+        const black: BoolVec = ctm == @as(U8Vec, @splat(@intFromEnum(board.Colour.BLACK)));
+        hash ^= @select(u64, black, @as(U64Vec, @splat(tt.colour_zobrist())), zero_u64);
+
+        const castling: U8Vec = self.castling[i..][0..VEC_LEN].*;
+        inline for (0..4) |c| {
+            const on: BoolVec = castling & @as(U8Vec, @splat(1 << c)) != @as(U8Vec, @splat(0));
+            hash ^= @select(u64, on, @as(U64Vec, @splat(tt.castle_zobrist(@enumFromInt(c)))), zero_u64);
+        }
+
+        // 8 (no file) when there is no ep square
+        const ep: U8Vec = self.ep[i..][0..VEC_LEN].*;
+        const ep_file = @select(u8, ep < @as(U8Vec, @splat(64)), ep & @as(U8Vec, @splat(7)), @as(U8Vec, @splat(8)));
+        for (0..8) |f| {
+            const on: BoolVec = ep_file == @as(U8Vec, @splat(@intCast(f)));
+            hash ^= @select(u64, on, @as(U64Vec, @splat(tt.ep_zobrist(f))), zero_u64);
+        }
+
+        // eval.tapered_eval, lane by lane
+        const mg_phase = @min(phase, @as(I32Vec, @splat(24)));
+        const eg_phase = @as(I32Vec, @splat(24)) - mg_phase;
+        const tapered = @divTrunc(mg * mg_phase + eg * eg_phase, @as(I32Vec, @splat(24)));
+
+        self.mg_val[i..][0..VEC_LEN].* = mg;
+        self.eg_val[i..][0..VEC_LEN].* = eg;
+        self.phase[i..][0..VEC_LEN].* = @as(U8Vec, @intCast(phase));
+        self.score[i..][0..VEC_LEN].* = @select(i32, black, -tapered, tapered);
+        self.hash[i..][0..VEC_LEN].* = hash;
+    }
+};
+
+// calls f(ctx, start, end) over [0, n) split into one contiguous range per
+// core, the last range runs on the calling thread
+pub fn parallel_for(n: usize, ctx: anytype, comptime f: fn (@TypeOf(ctx), usize, usize) void) !void {
+    const cpus = std.Thread.getCpuCount() catch 1;
+    const threads = @max(1, @min(cpus, n / MIN_CHUNKS_PER_THREAD));
+    if (threads == 1) return f(ctx, 0, n);
+
+    var handles: [255]std.Thread = undefined;
+    const extra = @min(threads - 1, handles.len);
+    const per_thread = n / (extra + 1);
+
+    var spawned: usize = 0;
+    defer for (handles[0..spawned]) |h| h.join();
+    while (spawned < extra) : (spawned += 1) {
+        handles[spawned] = try std.Thread.spawn(.{}, f, .{ ctx, spawned * per_thread, (spawned + 1) * per_thread });
+    }
+
+    f(ctx, extra * per_thread, n);
+}
@@ -0,0 +1,271 @@
+const std = @import("std");
+const builtin = @import("builtin");
+
+const board = @import("board.zig");
+const BB = board.BB;
+const Board = board.Board;
+const movegen = @import("movegen.zig");
+const eval = @import("eval.zig");
+const tt = @import("tt.zig");
+const batch = @import("batch.zig");
+
+// compares the magic and pext slider lookups on the same random positions,
+// copy_make against make/unmake on the same perft trees, and mailbox piece
+// lookups against scanning the bitboards, and the batch eval and hash
+// against the per board ones
+// run with `zig build bench -Doptimize=ReleaseFast`, the perft times include
+// keeping the mailbox up to date, compare them with a -Dmailbox=false build
+
+const SAMPLES = 1 << 16;
+const ROUNDS = 256;
+const SEED = 0x5EED;
+
+const Sample = struct { occ: BB, sq: usize };
+
+fn gen_samples(samples: []Sample) void {
+    var rng = std.Random.DefaultPrng.init(SEED);
+    const r = rng.random();
+    for (samples) |*s| {
+        // roughly middlegame density, about a quarter of the board occupied
+        s.* = .{ .occ = r.int(BB) & r.int(BB), .sq = r.uintLessThan(usize, 64) };
+    }
+}
+
+// returns ns per lookup, the checksum stops the lookups being optimised out
+// rook and bishop are the (inline) lookup functions
+fn time_lookups(samples: []const Sample, comptime rook: anytype, comptime bishop: anytype) !struct { f64, BB } {
+    var checksum: BB = 0;
+    var timer = try std.time.Timer.start();
+    for (0..ROUNDS) |_| {
+        for (samples) |s| {
+            checksum ^= rook(s.occ, s.sq);
+            checksum ^= bishop(s.occ, s.sq);
+        }
+    }
+    const ns = timer.read();
+
+    std.mem.doNotOptimizeAway(checksum);
+    const lookups: f64 = @floatFromInt(2 * ROUNDS * samples.len);
+    return .{ @as(f64, @floatFromInt(ns)) / lookups, checksum };
+}
+
+fn bench_pext(w: *std.Io.Writer, samples: []const Sample, magic_ns: f64, magic_sum: BB) !void {
+    if (!movegen.pext_supported()) {
+        try w.print("pext: cpu doesn't support bmi2\n", .{});
+        return;
+    }
+
+    const pext_ns, const pext_sum = try time_lookups(samples, movegen.lookup_rook_pext, movegen.lookup_bishop_pext);
+    try w.print("pext:  {d:.2} ns/lookup ({d:.2}x)\n", .{ pext_ns, magic_ns / pext_ns });
+
+    if (magic_sum != pext_sum) {
+        try w.print("magic and pext lookups disagree!\n", .{});
+        return error.LookupMismatch;
+    }
+}
+
+const MAKE_FENS = [_][]const u8{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+};
+const MAKE_DEPTH = 4;
+
+fn perft_copy(b: *const Board, depth: usize) usize {
+    if (depth == 0) return 1;
+
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
+
+    var mc: usize = 0;
+    var next: Board = undefined;
+    while (ml.next()) |m| {
+        b.copy_make(&next, m);
+        mc += perft_copy(&next, depth - 1);
+    }
+    return mc;
+}
+
+fn perft_unmake(b: *Board, depth: usize) usize {
+    if (depth == 0) return 1;
+
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
+
+    var mc: usize = 0;
+    while (ml.next()) |m| {
+        const undo = b.make(m);
+        mc += perft_unmake(b, depth - 1);
+        b.unmake(m, undo);
+    }
+    return mc;
+}
+
+// returns ns per node and the node count over all of MAKE_FENS
+fn time_perft(comptime mode: board.MakeMode) !struct { f64, usize } {
+    var nodes: usize = 0;
+    var timer = try std.time.Timer.start();
+    for (MAKE_FENS) |fen| {
+        var b = try board.board_from_fen(fen);
+        nodes += switch (mode) {
+            .copy => perft_copy(&b, MAKE_DEPTH),
+            .unmake => perft_unmake(&b, MAKE_DEPTH),
+        };
+    }
+    const ns = timer.read();
+
+    return .{ @as(f64, @floatFromInt(ns)) / @as(f64, @floatFromInt(nodes)), nodes };
+}
+
+fn bench_make(w: *std.Io.Writer) !void {
+    try w.print("\nmake mode for this build: {s}\n", .{@tagName(board.make_mode)});
+
+    const copy_ns, const copy_nodes = try time_perft(.copy);
+    try w.print("copy:   {d:.2} ns/node\n", .{copy_ns});
+
+    const unmake_ns, const unmake_nodes = try time_perft(.unmake);
+    try w.print("unmake: {d:.2} ns/node ({d:.2}x)\n", .{ unmake_ns, copy_ns / unmake_ns });
+
+    if (copy_nodes != unmake_nodes) {
+        try w.print("copy and unmake perft counts disagree!\n", .{});
+        return error.MakeMismatch;
+    }
+}
+
+// returns ns per lookup of every square of every MAKE_FENS position
+fn time_piece_lookups(boards: []const Board, comptime lookup: anytype) !struct { f64, usize } {
+    var checksum: usize = 0;
+    var timer = try std.time.Timer.start();
+    for (0..ROUNDS * 16) |_| {
+        for (boards) |*b| {
+            for (0..64) |sq| checksum +%= @intFromEnum(lookup(b, sq)) *% (sq + 1);
+        }
+    }
+    const ns = timer.read();
+
+    std.mem.doNotOptimizeAway(checksum);
+    const lookups: f64 = @floatFromInt(ROUNDS * 16 * boards.len * 64);
+    return .{ @as(f64, @floatFromInt(ns)) / lookups, checksum };
+}
+
+fn bench_mailbox(w: *std.Io.Writer) !void {
+    try w.print("\nmailbox for this build: {}, board is {d} bytes\n", .{ board.has_mailbox, @sizeOf(Board) });
+
+    var boards: [MAKE_FENS.len]Board = undefined;
+    for (&boards, MAKE_FENS) |*b, fen| b.* = try board.board_from_fen(fen);
+
+    const scan_ns, const scan_sum = try time_piece_lookups(&boards, Board.scan_piece);
+    try w.print("scan:    {d:.2} ns/lookup\n", .{scan_ns});
+
+    if (comptime !board.has_mailbox) return;
+
+    const mailbox_ns, const mailbox_sum = try time_piece_lookups(&boards, Board.get_piece);
+    try w.print("mailbox: {d:.2} ns/lookup ({d:.2}x)\n", .{ mailbox_ns, scan_ns / mailbox_ns });
+
+    if (scan_sum != mailbox_sum) {
+        try w.print("mailbox and scanned pieces disagree!\n", .{});
+        return error.MailboxMismatch;
+    }
+}
+
+const BATCH_POSITIONS = 1 << 20;
+const PLAYOUT_PLIES = 120;
+
+// random playouts from MAKE_FENS, so the positions have a spread of material
+fn gen_positions(positions: []Board) !void {
+    var rng = std.Random.DefaultPrng.init(SEED);
+    const r = rng.random();
+
+    var b = try board.board_from_fen(MAKE_FENS[0]);
+    var ply: usize = 0;
+    for (positions) |*p| {
+        var ml = movegen.MoveList.new(&b, null, null);
+        movegen.gen_moves(&ml);
+        if (ml.count == 0 or ply == PLAYOUT_PLIES) {
+            b = try board.board_from_fen(MAKE_FENS[r.uintLessThan(usize, MAKE_FENS.len)]);
+            ply = 0;
+        } else {
+            for (0..r.uintLessThan(usize, ml.count)) |_| _ = ml.next();
+            var next: Board = undefined;
+            b.copy_make(&next, ml.next().?);
+            b = next;
+            ply += 1;
+        }
+        p.* = b;
+    }
+}
+
+fn bench_batch(w: *std.Io.Writer) !void {
+    const allocator = std.heap.page_allocator;
+    const positions = try allocator.alloc(Board, BATCH_POSITIONS);
+    defer allocator.free(positions);
+    try gen_positions(positions);
+
+    var checksum: u64 = 0;
+    var timer = try std.time.Timer.start();
+    for (positions) |*b| {
+        const mg_val, const eg_val, const phase = eval.eval_board_full(b);
+        checksum +%= @as(u64, @bitCast(@as(i64, mg_val + eg_val))) +% phase +% tt.hash_board(b);
+    }
+    const scalar_ns = timer.read();
+    std.mem.doNotOptimizeAway(checksum);
+
+    var blk = try batch.Batch.init(allocator, positions.len);
+    defer blk.deinit();
+    for (positions, 0..) |*b, i| blk.set(i, b);
+
+    timer.reset();
+    blk.run_single();
+    const single_ns = timer.read();
+
+    timer.reset();
+    try blk.run();
+    const parallel_ns = timer.read();
+
+    const n: f64 = @floatFromInt(positions.len);
+    const scalar_mps = n / @as(f64, @floatFromInt(scalar_ns)) * 1000;
+    const single_mps = n / @as(f64, @floatFromInt(single_ns)) * 1000;
+    const parallel_mps = n / @as(f64, @floatFromInt(parallel_ns)) * 1000;
+    try w.print("\nscalar eval and hash: {d:.2}M positions/s\n", .{scalar_mps});
+    try w.print("batch, one thread:    {d:.2}M positions/s ({d:.2}x)\n", .{ single_mps, single_mps / scalar_mps });
+    try w.print("batch, all cores:     {d:.2}M positions/s ({d:.2}x)\n", .{ parallel_mps, parallel_mps / scalar_mps });
+
+    for (positions, 0..) |*b, i| {
+        const mg_val, const eg_val, const phase = eval.eval_board_full(b);
+        if (blk.mg_val[i] != mg_val or blk.eg_val[i] != eg_val or blk.phase[i] != phase or
+            blk.score[i] != eval.board_score(b) or blk.hash[i] != tt.hash_board(b))
+        {
+            try w.print("batch and scalar eval disagree on position {d}!\n", .{i});
+            return error.BatchMismatch;
+        }
+    }
+}
+
+pub fn main() !void {
+    var stdout = std.fs.File.stdout();
+    var buf: [1024]u8 = undefined;
+    var writer = stdout.writer(&buf);
+    const w = &writer.interface;
+
+    const samples = try std.heap.page_allocator.alloc(Sample, SAMPLES);
+    defer std.heap.page_allocator.free(samples);
+    gen_samples(samples);
+
+    try w.print("slider lookup for this build: {s}\n", .{@tagName(movegen.slider_lookup)});
+
+    const magic_ns, const magic_sum = try time_lookups(samples, movegen.lookup_rook_magic, movegen.lookup_bishop_magic);
+    try w.print("magic: {d:.2} ns/lookup\n", .{magic_ns});
+
+    // the pext lookups don't exist off x86_64, so they mustn't even be compiled
+    if (comptime builtin.cpu.arch == .x86_64) {
+        try bench_pext(w, samples, magic_ns, magic_sum);
+    } else {
+        try w.print("pext: not available on {s}\n", .{@tagName(builtin.cpu.arch)});
+    }
+
+    try bench_make(w);
+    try bench_mailbox(w);
+    try bench_batch(w);
+
+    try w.flush();
+}
@@ -8,11 +8,30 @@ const util = @import("util.zig");
 const eval = @import("eval.zig");
 const tt = @import("tt.zig");
 const consts = @import("consts");
+const config = @import("config");
 
 pub const BB = u64;
 
 pub const CastleState = u8;
 
+// copy makes every child into a fresh board (see Board.copy_make), unmake
+// makes moves in place and undoes them from an Undo (see Board.make)
+pub const MakeMode = enum { copy, unmake };
+
+// picked by the make_mode build option, which one is faster depends on the
+// target's memory bandwidth
+pub const make_mode: MakeMode = switch (config.make_mode) {
+    .copy => .copy,
+    .unmake => .unmake,
+};
+
+// with the mailbox each square also stores its piece, so finding what is on a
+// square is a load instead of a scan of the piece bitboards, at the cost of a
+// bigger board to copy
+pub const has_mailbox = config.mailbox;
+
+const Mailbox = if (has_mailbox) [64]Piece else void;
+
 pub fn square(idx: usize) BB {
     return @as(BB, 1) << @as(u6, @intCast(idx));
 }
@@ -152,6 +171,19 @@ pub fn char_from_piece(p: Piece) u8 {
     };
 }
 
+// everything make can't work out backwards from the move, the bitboards are
+// restored by moving the pieces back
+pub const Undo = struct {
+    hash: u64,
+    mg_val: i32,
+    eg_val: i32,
+    castling: CastleState,
+    ep: u8,
+    halfmove: u8,
+    phase: u8,
+    xpiece: Piece,
+};
+
 pub const Board = struct {
     pieces: [12]BB,
     // util: [3]BB,
@@ -164,6 +196,8 @@ pub const Board = struct {
     mg_val: i32,
     eg_val: i32,
     phase: u8,
+    // kept in step with pieces by toggle_piece_on/off and unmake
+    mailbox: Mailbox,
 
     pub inline fn piece_bb(self: *const Board, p: Piece, c: Colour) BB {
         const pidx: usize = @intFromEnum(p);
@@ -183,6 +217,7 @@ pub const Board = struct {
 
     inline fn toggle_piece_on(self: *Board, p: Piece, sq: usize) void {
         self.pieces[@intFromEnum(p)] ^= square(sq);
+        self.put(sq, p);
         self.hash ^= tt.piece_zobrist(p, sq);
 
         self.mg_val += eval.MAT_SCORES[@intFromEnum(p)];
@@ -195,6 +230,11 @@ pub const Board = struct {
 
     inline fn toggle_piece_off(self: *Board, p: Piece, sq: usize) void {
         self.pieces[@intFromEnum(p)] ^= square(sq);
+        // a capture toggles the captured piece off after the capturer has
+        // landed, which mustn't empty the square
+        if (comptime has_mailbox) {
+            self.mailbox[sq] = if (self.mailbox[sq] == p) .NONE else self.mailbox[sq];
+        }
         self.hash ^= tt.piece_zobrist(p, sq);
 
         self.mg_val -= eval.MAT_SCORES[@intFromEnum(p)];
@@ -205,11 +245,33 @@ pub const Board = struct {
         self.phase -= eval.PIECE_PHASE_VAL[@intFromEnum(p)];
     }
 
+    // only moves the piece, unmake restores the hash and eval from the undo
+    // and puts the mailbox back itself
+    inline fn flip_piece(self: *Board, p: Piece, bb: BB) void {
+        self.pieces[@intFromEnum(p)] ^= bb;
+    }
+
+    inline fn put(self: *Board, sq: usize, p: Piece) void {
+        if (comptime has_mailbox) self.mailbox[sq] = p;
+    }
+
+    // builds the mailbox from the piece bitboards
+    fn fill_mailbox(self: *Board) void {
+        if (comptime !has_mailbox) return;
+        for (0..64) |sq| self.mailbox[sq] = self.scan_piece(sq);
+    }
+
     inline fn toggle_colour_pieces(self: *Board, c: Colour, bb: BB) void {
         self.util[@intFromEnum(c)] ^= bb;
     }
 
-    pub fn get_piece(self: *const Board, sq: usize) Piece {
+    pub inline fn get_piece(self: *const Board, sq: usize) Piece {
+        if (comptime has_mailbox) return self.mailbox[sq];
+        return self.scan_piece(sq);
+    }
+
+    // finds the piece from the bitboards, whether or not there is a mailbox
+    pub fn scan_piece(self: *const Board, sq: usize) Piece {
         const bb = square(sq);
         inline for (0..self.pieces.len) |i| {
             if (self.pieces[i] & bb > 0) {
@@ -220,7 +282,13 @@ pub const Board = struct {
         return Piece.NONE;
     }
 
-    pub fn get_piece_not_none(self: *const Board, sq_idx: usize, c: Colour) Piece {
+    pub inline fn get_piece_not_none(self: *const Board, sq_idx: usize, c: Colour) Piece {
+        if (comptime has_mailbox) {
+            const p = self.mailbox[sq_idx];
+            std.debug.assert(p != .NONE and @intFromEnum(p) & 1 == @intFromEnum(c));
+            return p;
+        }
+
         const sq = square(sq_idx);
         const offset: u8 = @intFromEnum(c);
         var piece: u8 = 0;
@@ -308,77 +376,77 @@ pub const Board = struct {
         self.halfmove = self.halfmove * @as(u8, @intFromBool(@intFromEnum(p) < 2));
     }
 
-    fn apply_double(self: *Board, to: usize) void {
-        const ep: usize = to - 8 + (@intFromEnum(self.ctm) * 16);
+    fn apply_double(self: *Board, comptime ctm: Colour, to: usize) void {
+        const ep: usize = to - 8 + (comptime @as(usize, @intFromEnum(ctm)) * 16);
         self.ep = @intCast(ep);
         self.hash ^= tt.ep_zobrist(ep);
     }
 
-    fn apply_cap(self: *Board, to: usize, xpiece: Piece) void {
+    fn apply_cap(self: *Board, comptime ctm: Colour, to: usize, xpiece: Piece) void {
         const to_sq = square(to);
         self.toggle_piece_off(xpiece, to);
-        self.toggle_colour_pieces(self.ctm.opp(), to_sq);
+        self.toggle_colour_pieces(comptime ctm.opp(), to_sq);
         // self.toggle_all_pieces(to_sq);
     }
 
-    fn apply_castle(self: *Board, c: Colour, from: usize, to: usize) void {
-        const from_to: BB = square(from) | square(to);
-        self.toggle_piece_off(Piece.ROOK.with_ctm(c), from);
-        self.toggle_piece_on(Piece.ROOK.with_ctm(c), to);
+    fn apply_castle(self: *Board, comptime c: Colour, comptime from: usize, comptime to: usize) void {
+        const from_to: BB = comptime square(from) | square(to);
+        self.toggle_piece_off(comptime Piece.ROOK.with_ctm(c), from);
+        self.toggle_piece_on(comptime Piece.ROOK.with_ctm(c), to);
         self.toggle_colour_pieces(c, from_to);
         // self.toggle_all_pieces(from_to);
     }
 
-    fn apply_promo(self: *Board, xpiece: Piece, to: usize) void {
+    fn apply_promo(self: *Board, comptime ctm: Colour, mt: MoveType, to: usize) void {
         // toggle pawn off and toggle the promo on
-        self.toggle_piece_off(Piece.PAWN.with_ctm(self.ctm), to);
-        self.toggle_piece_on(xpiece, to);
+        self.toggle_piece_off(comptime Piece.PAWN.with_ctm(ctm), to);
+        self.toggle_piece_on(mt.promo_piece().with_ctm(ctm), to);
         self.halfmove = 0;
     }
 
-    fn apply_promo_cap(self: *Board, mt: movegen.MoveType, xpiece: Piece, to: usize) void {
+    fn apply_promo_cap(self: *Board, comptime ctm: Colour, mt: MoveType, xpiece: Piece, to: usize) void {
         const to_sq: BB = square(to);
-        const promo_p: Piece = @enumFromInt((@intFromEnum(mt) - 7) * 2);
+        const promo_p: Piece = mt.promo_piece();
 
         // toggle captured piece
         self.toggle_piece_off(xpiece, to);
-        self.toggle_colour_pieces(self.ctm.opp(), to_sq);
+        self.toggle_colour_pieces(comptime ctm.opp(), to_sq);
 
         // retoggle piece (as its been replaces by the capturer)
         // self.toggle_all_pieces(to_sq);
 
         // toggle pawn off
-        self.toggle_piece_off(Piece.PAWN.with_ctm(self.ctm), to);
+        self.toggle_piece_off(comptime Piece.PAWN.with_ctm(ctm), to);
 
         // toggle promo on
-        self.toggle_piece_on(promo_p.with_ctm(self.ctm), to);
+        self.toggle_piece_on(promo_p.with_ctm(ctm), to);
 
         self.halfmove = 0;
     }
 
-    fn apply_ep(self: *Board, to: usize) void {
-        const ep: usize = to - 8 + (@intFromEnum(self.ctm) * 16);
+    fn apply_ep(self: *Board, comptime ctm: Colour, to: usize) void {
+        const ep: usize = to - 8 + (comptime @as(usize, @intFromEnum(ctm)) * 16);
         const ep_sq = square(ep);
         // toggle capture pawn off
-        self.toggle_piece_off(Piece.PAWN.with_ctm(self.ctm.opp()), ep);
-        self.toggle_colour_pieces(self.ctm.opp(), ep_sq);
+        self.toggle_piece_off(comptime Piece.PAWN.with_ctm(ctm.opp()), ep);
+        self.toggle_colour_pieces(comptime ctm.opp(), ep_sq);
         // self.toggle_all_pieces(ep_sq);
 
         self.halfmove = 0;
     }
 
-    fn apply_move(self: *Board, to: usize, piece: Piece, xpiece: Piece, mt: MoveType) void {
+    fn apply_move(self: *Board, comptime ctm: Colour, to: usize, piece: Piece, xpiece: Piece, mt: MoveType) void {
         switch (mt) {
             MoveType.QUIET => self.apply_quiet(piece),
-            MoveType.DOUBLE => self.apply_double(to),
-            MoveType.CAP => self.apply_cap(to, xpiece),
+            MoveType.DOUBLE => self.apply_double(ctm, to),
+            MoveType.CAP => self.apply_cap(ctm, to, xpiece),
             MoveType.WKINGSIDE => self.apply_castle(Colour.WHITE, 7, 5),
             MoveType.WQUEENSIDE => self.apply_castle(Colour.WHITE, 0, 3),
             MoveType.BKINGSIDE => self.apply_castle(Colour.BLACK, 63, 61),
             MoveType.BQUEENSIDE => self.apply_castle(Colour.BLACK, 56, 59),
-            MoveType.PROMO => self.apply_promo(xpiece, to),
-            MoveType.NPROMOCAP, MoveType.RPROMOCAP, MoveType.BPROMOCAP, MoveType.QPROMOCAP => self.apply_promo_cap(mt, xpiece, to),
-            MoveType.EP => self.apply_ep(to),
+            MoveType.NPROMO, MoveType.RPROMO, MoveType.BPROMO, MoveType.QPROMO => self.apply_promo(ctm, mt, to),
+            MoveType.NPROMOCAP, MoveType.RPROMOCAP, MoveType.BPROMOCAP, MoveType.QPROMOCAP => self.apply_promo_cap(ctm, mt, xpiece, to),
+            MoveType.EP => self.apply_ep(ctm, to),
         }
     }
 
@@ -392,34 +460,144 @@ pub const Board = struct {
         self.halfmove -= 1;
     }
 
+    // each colour gets its own copy of make, so the side to move and
+    // everything derived from it is a constant
     pub fn copy_make(self: *const Board, dest: *Board, m: Move) void {
+        switch (self.ctm) {
+            inline else => |ctm| self.copy_make_for(ctm, dest, m),
+        }
+    }
+
+    fn copy_make_for(self: *const Board, comptime ctm: Colour, dest: *Board, m: Move) void {
         // cannot copy into itself
         std.debug.assert(self != dest);
+        std.debug.assert(self.ctm == ctm);
         dest.* = self.*;
 
+        // the pieces aren't stored in the move, so look them up before
+        // anything is moved
+        const piece: Piece = self.get_piece_not_none(m.from, ctm);
+        const xpiece: Piece = captured_piece(ctm, self, m);
+        dest.make_move(ctm, m, piece, xpiece);
+    }
+
+    // makes m in place, the returned undo has to be given back to unmake
+    pub fn make(self: *Board, m: Move) Undo {
+        switch (self.ctm) {
+            inline else => |ctm| return self.make_for(ctm, m),
+        }
+    }
+
+    fn make_for(self: *Board, comptime ctm: Colour, m: Move) Undo {
+        const piece: Piece = self.get_piece_not_none(m.from, ctm);
+        const xpiece: Piece = captured_piece(ctm, self, m);
+
+        const undo = Undo{
+            .hash = self.hash,
+            .mg_val = self.mg_val,
+            .eg_val = self.eg_val,
+            .castling = self.castling,
+            .ep = self.ep,
+            .halfmove = self.halfmove,
+            .phase = self.phase,
+            .xpiece = xpiece,
+        };
+
+        self.make_move(ctm, m, piece, xpiece);
+        return undo;
+    }
+
+    // the ep pawn isn't on the to square, apply_ep finds it itself
+    inline fn captured_piece(comptime ctm: Colour, b: *const Board, m: Move) Piece {
+        if (!m.mt.is_cap() or m.mt == .EP) return .NONE;
+        return b.get_piece_not_none(m.to, comptime ctm.opp());
+    }
+
+    fn make_move(self: *Board, comptime ctm: Colour, m: Move, piece: Piece, xpiece: Piece) void {
         const from: usize = @intCast(m.from);
         const to: usize = @intCast(m.to);
-        const piece: Piece = m.piece;
-        const xpiece: Piece = m.xpiece;
-
         const from_to: BB = square(from) | square(to);
 
-        dest.toggle_piece_off(piece, from);
-        dest.toggle_piece_on(piece, to);
-        dest.toggle_colour_pieces(dest.ctm, from_to);
-        // dest.toggle_all_pieces(from_to);
+        self.toggle_piece_off(piece, from);
+        self.toggle_piece_on(piece, to);
+        self.toggle_colour_pieces(ctm, from_to);
+        // self.toggle_all_pieces(from_to);
 
-        dest.set_castle_state(piece, from, to);
+        self.set_castle_state(piece, from, to);
 
         // unset the ep from the hash
-        dest.hash ^= tt.ep_zobrist(dest.ep) * @as(u64, @intFromBool(dest.ep < 64));
-        dest.ep = 64;
-        dest.halfmove += 1;
+        self.hash ^= tt.ep_zobrist(self.ep) * @as(u64, @intFromBool(self.ep < 64));
+        self.ep = 64;
+        self.halfmove += 1;
+
+        self.apply_move(ctm, to, piece, xpiece, m.mt);
+
+        self.ctm = comptime ctm.opp();
+        self.hash ^= tt.colour_zobrist();
+    }
+
+    // takes back m, which must have been the last move made on this board
+    pub fn unmake(self: *Board, m: Move, undo: Undo) void {
+        switch (self.ctm) {
+            inline else => |ctm| self.unmake_for(comptime ctm.opp(), m, undo),
+        }
+    }
 
-        dest.apply_move(to, piece, xpiece, m.mt);
+    // ctm is the side that made m
+    fn unmake_for(self: *Board, comptime ctm: Colour, m: Move, undo: Undo) void {
+        const from: usize = @intCast(m.from);
+        const to: usize = @intCast(m.to);
+        const from_sq = square(from);
+        const to_sq = square(to);
 
-        dest.ctm = self.ctm.opp();
-        dest.hash ^= tt.colour_zobrist();
+        // put the mover back, a promoted piece goes back to being a pawn
+        if (m.mt.is_promo()) {
+            self.flip_piece(m.mt.promo_piece().with_ctm(ctm), to_sq);
+            self.flip_piece(comptime Piece.PAWN.with_ctm(ctm), from_sq);
+            self.put(from, comptime Piece.PAWN.with_ctm(ctm));
+        } else {
+            const piece = self.get_piece_not_none(to, ctm);
+            self.flip_piece(piece, from_sq | to_sq);
+            self.put(from, piece);
+        }
+        self.toggle_colour_pieces(ctm, from_sq | to_sq);
+        self.put(to, .NONE);
+
+        switch (m.mt) {
+            .CAP, .NPROMOCAP, .RPROMOCAP, .BPROMOCAP, .QPROMOCAP => {
+                self.flip_piece(undo.xpiece, to_sq);
+                self.toggle_colour_pieces(comptime ctm.opp(), to_sq);
+                self.put(to, undo.xpiece);
+            },
+            .EP => {
+                const ep = to - 8 + (comptime @as(usize, @intFromEnum(ctm)) * 16);
+                self.flip_piece(comptime Piece.PAWN.with_ctm(ctm.opp()), square(ep));
+                self.toggle_colour_pieces(comptime ctm.opp(), square(ep));
+                self.put(ep, comptime Piece.PAWN.with_ctm(ctm.opp()));
+            },
+            .WKINGSIDE => self.unmake_castle(.WHITE, 7, 5),
+            .WQUEENSIDE => self.unmake_castle(.WHITE, 0, 3),
+            .BKINGSIDE => self.unmake_castle(.BLACK, 63, 61),
+            .BQUEENSIDE => self.unmake_castle(.BLACK, 56, 59),
+            else => {},
+        }
+
+        self.ctm = ctm;
+        self.castling = undo.castling;
+        self.ep = undo.ep;
+        self.halfmove = undo.halfmove;
+        self.hash = undo.hash;
+        self.mg_val = undo.mg_val;
+        self.eg_val = undo.eg_val;
+        self.phase = undo.phase;
+    }
+
+    fn unmake_castle(self: *Board, comptime c: Colour, comptime from: usize, comptime to: usize) void {
+        const from_to: BB = comptime square(from) | square(to);
+        self.flip_piece(comptime Piece.ROOK.with_ctm(c), from_to);
+        self.toggle_colour_pieces(c, from_to);
+        self.put(from, comptime Piece.ROOK.with_ctm(c));
+        self.put(to, .NONE);
     }
 
     pub fn log(self: Board, comptime log_fn: fn (comptime []const u8, anytype) void) void {
@@ -460,9 +638,11 @@ pub fn default_board() Board {
         .mg_val = undefined,
         .eg_val = undefined,
         .phase = undefined,
+        .mailbox = undefined,
     };
 
     // TODO hash and eval
+    board.fill_mailbox();
 
     board.hash = tt.hash_board(&board);
     board.mg_val, board.eg_val, board.phase = eval.eval_board_full(&board);
@@ -476,6 +656,9 @@ pub fn cmp_boards(b1: *const Board, b2: *const Board) bool {
     for (b1.util, b2.util) |util1, util2| {
         if (util1 != util2) return false;
     }
+    if (comptime has_mailbox) {
+        if (!std.mem.eql(Piece, &b1.mailbox, &b2.mailbox)) return false;
+    }
 
     if (b1.ctm != b2.ctm) return false;
     if (b1.castling != b2.castling) return false;
@@ -580,6 +763,7 @@ pub fn board_from_fen(fen: []const u8) !Board {
 
     const pieces_str = it.next() orelse return error.InvalidFenNoPieces;
     try parse_pieces(pieces_str, &b.pieces, &b.util);
+    b.fill_mailbox();
 
     const ctm_str = it.next() orelse return error.InvalidFenNoCtm;
     b.ctm = try parse_ctm(ctm_str);
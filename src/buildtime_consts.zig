@@ -32,6 +32,18 @@ var rook_move_table: [64][4096]BB = undefined;
 
 var knight_move_table: [64]BB = undefined;
 
+// pext tables are packed, each square only takes 2^popcount(mask) entries
+// starting from its offset
+const PextEntry = struct { mask: BB, offset: u32 };
+const ROOK_PEXT_SIZE = 102400;
+const BISHOP_PEXT_SIZE = 5248;
+
+var rook_pext: [64]PextEntry = undefined;
+var bishop_pext: [64]PextEntry = undefined;
+
+var rook_pext_table: [ROOK_PEXT_SIZE]BB = undefined;
+var bishop_pext_table: [BISHOP_PEXT_SIZE]BB = undefined;
+
 // TODO could move this into the build scriptx
 fn init_knight_move_table() void {
     for (0..64) |i| {
@@ -118,6 +130,109 @@ pub fn init_super_moves() void {
     }
 }
 
+// king and pawn against king, solved by retrograde analysis. the pawn is
+// always white and on files a-d (probes mirror the board to match) and
+// ranks 2-7, a set bit means white wins with that side to move
+// heavily inspired by stockfish's bitbase.cpp
+const KPK_SIZE = 2 * 24 * 64 * 64;
+var kpk_bitbase: [KPK_SIZE / 64]u64 = undefined;
+
+// flags so that the results of every move can be or'd together
+const KPK_INVALID: u8 = 0;
+const KPK_UNKNOWN: u8 = 1;
+const KPK_DRAW: u8 = 2;
+const KPK_WIN: u8 = 4;
+
+// stm is 0 for white, must match endgame.kpk_index
+fn kpk_index(stm: usize, wk: usize, bk: usize, psq: usize) usize {
+    const pawn_idx = (psq / 8 - 1) * 4 + psq % 8;
+    return stm * 24 * 4096 + pawn_idx * 4096 + wk * 64 + bk;
+}
+
+fn sq_distance(a: usize, b: usize) usize {
+    const file_dist = @max(a % 8, b % 8) - @min(a % 8, b % 8);
+    const rank_dist = @max(a / 8, b / 8) - @min(a / 8, b / 8);
+    return @max(file_dist, rank_dist);
+}
+
+fn kpk_initial(stm: usize, wk: usize, bk: usize, psq: usize) u8 {
+    // pieces on top of each other or a king that could be taken
+    if (sq_distance(wk, bk) <= 1 or wk == psq or bk == psq) return KPK_INVALID;
+    if (stm == 0 and pawn_attack_table[psq] & square(bk) > 0) return KPK_INVALID;
+
+    // the pawn queens and can't be taken straight away
+    const push = psq + 8;
+    if (stm == 0 and psq / 8 == 6 and wk != push and
+        (sq_distance(bk, push) > 1 or sq_distance(wk, push) == 1)) return KPK_WIN;
+
+    // stalemate, or black can take the pawn
+    if (stm == 1) {
+        const bk_moves = king_move_table[bk];
+        if (bk_moves & ~(king_move_table[wk] | pawn_attack_table[psq]) == 0) return KPK_DRAW;
+        if (bk_moves & ~king_move_table[wk] & square(psq) > 0) return KPK_DRAW;
+    }
+
+    return KPK_UNKNOWN;
+}
+
+// white wins if any move wins, black draws if any move draws. moves into
+// invalid positions (eg. next to the other king) or that were already
+// decided by kpk_initial (queening, taking the pawn) add nothing
+fn kpk_classify(db: []const u8, stm: usize, wk: usize, bk: usize, psq: usize) u8 {
+    const good = if (stm == 0) KPK_WIN else KPK_DRAW;
+    const bad = if (stm == 0) KPK_DRAW else KPK_WIN;
+
+    var r: u8 = KPK_INVALID;
+    var moves = king_move_table[if (stm == 0) wk else bk];
+    while (moves > 0) : (moves &= moves - 1) {
+        const to: usize = @ctz(moves);
+        r |= if (stm == 0) db[kpk_index(1, to, bk, psq)] else db[kpk_index(0, wk, to, psq)];
+    }
+
+    if (stm == 0) {
+        if (psq / 8 < 6) r |= db[kpk_index(1, wk, bk, psq + 8)];
+        if (psq / 8 == 1 and psq + 8 != wk and psq + 8 != bk) r |= db[kpk_index(1, wk, bk, psq + 16)];
+    }
+
+    if (r & good > 0) return good;
+    if (r & KPK_UNKNOWN > 0) return KPK_UNKNOWN;
+    return bad;
+}
+
+// requires the king moves and pawn attacks to be initialised
+fn gen_kpk_bitbase(allocator: std.mem.Allocator) !void {
+    const db = try allocator.alloc(u8, KPK_SIZE);
+    defer allocator.free(db);
+
+    for (0..KPK_SIZE) |idx| {
+        const stm, const wk, const bk, const psq = kpk_decode(idx);
+        db[idx] = kpk_initial(stm, wk, bk, psq);
+    }
+
+    var changed = true;
+    while (changed) {
+        changed = false;
+        for (0..KPK_SIZE) |idx| {
+            if (db[idx] != KPK_UNKNOWN) continue;
+            const stm, const wk, const bk, const psq = kpk_decode(idx);
+            db[idx] = kpk_classify(db, stm, wk, bk, psq);
+            changed = changed or db[idx] != KPK_UNKNOWN;
+        }
+    }
+
+    // anything still unknown can't be forced, so is a draw
+    @memset(&kpk_bitbase, 0);
+    for (db, 0..) |r, idx| {
+        if (r == KPK_WIN) kpk_bitbase[idx / 64] |= square(idx % 64);
+    }
+}
+
+fn kpk_decode(idx: usize) struct { usize, usize, usize, usize } {
+    const pawn_idx = (idx / 4096) % 24;
+    const psq = (pawn_idx / 4 + 1) * 8 + pawn_idx % 4;
+    return .{ idx / (24 * 4096), (idx / 64) % 64, idx % 64, psq };
+}
+
 fn write_int_array(w: *Io.Writer, comptime T: type, a: []const T, name: []const u8) !void {
     try w.print("pub const {s}: [{d}]{s} = .{{\n", .{ name, a.len, @typeName(T) });
     for (a) |i| {
@@ -138,6 +253,14 @@ fn write_mt_array(w: *Io.Writer, s: comptime_int, a: [][s]BB, name: []const u8)
     try w.print("}};\n", .{});
 }
 
+fn write_pext(w: *Io.Writer, a: []PextEntry, name: []const u8) !void {
+    try w.print("pub const {s}: [{d}]PextEntry = .{{\n", .{ name, a.len });
+    for (a) |e| {
+        try w.print("\t.{{ .mask = 0x{X}, .offset = {d}}},\n", .{ e.mask, e.offset });
+    }
+    try w.print("}};\n", .{});
+}
+
 fn write_sq_mag(w: *Io.Writer, a: []SquareMagic, name: []const u8) !void {
     try w.print("pub const {s}: [{d}]SquareMagic = .{{\n", .{ name, a.len });
     for (a) |m| {
@@ -148,6 +271,7 @@ fn write_sq_mag(w: *Io.Writer, a: []SquareMagic, name: []const u8) !void {
 
 pub fn main() !void {
     try gen_magics();
+    gen_pext_tables();
 
     init_zobrist();
 
@@ -160,6 +284,8 @@ pub fn main() !void {
     defer arena_state.deinit();
     const arena = arena_state.allocator();
 
+    try gen_kpk_bitbase(arena);
+
     const args = try std.process.argsAlloc(arena);
 
     const output_file_path = args[1];
@@ -175,6 +301,7 @@ pub fn main() !void {
 
     try w.print("const BB = u64;\n", .{});
     try w.print("const SquareMagic = struct {{ mask: BB, magic: u64 }};\n", .{});
+    try w.print("const PextEntry = struct {{ mask: BB, offset: u32 }};\n", .{});
 
     try write_int_array(w, u64, &zobrist, "zobrist");
 
@@ -182,6 +309,7 @@ pub fn main() !void {
     try write_int_array(w, BB, &knight_move_table, "knight_move_table");
     try write_int_array(w, BB, &king_move_table, "king_move_table");
     try write_int_array(w, BB, &super_moves, "super_moves");
+    try write_int_array(w, u64, &kpk_bitbase, "kpk_bitbase");
 
     try write_int_array(w, i16, &WPAWN_MID_PST, "WPAWN_MID_PST");
     try write_int_array(w, i16, &WPAWN_END_PST, "WPAWN_END_PST");
@@ -215,6 +343,11 @@ pub fn main() !void {
     try write_mt_array(w, 4096, &rook_move_table, "rook_move_table");
     try write_mt_array(w, 512, &bishop_move_table, "bishop_move_table");
 
+    try write_pext(w, &rook_pext, "rook_pext");
+    try write_pext(w, &bishop_pext, "bishop_pext");
+    try write_int_array(w, BB, &rook_pext_table, "rook_pext_table");
+    try write_int_array(w, BB, &bishop_pext_table, "bishop_pext_table");
+
     try w.flush();
     return std.process.cleanExit();
 }
@@ -453,6 +586,43 @@ pub fn gen_magics() !void {
     }
 }
 
+// the inverse of pext, bit i of src goes to the ith lowest set bit of mask
+fn pdep(src: usize, mask: BB) BB {
+    var m = mask;
+    var bb: BB = 0;
+    var i: usize = 0;
+    while (m > 0) : (m &= m - 1) {
+        if (src & square(i) > 0) bb |= square(@ctz(m));
+        i += 1;
+    }
+
+    return bb;
+}
+
+// no searching needed for pext, pext(occ, mask) is the index of occ's moves
+fn gen_pext(table: []BB, entries: []PextEntry, comptime is_rook: bool) void {
+    var offset: usize = 0;
+    for (0..64) |sq| {
+        const mask = if (is_rook) rmask(sq) else bmask(sq);
+        entries[sq] = .{ .mask = mask, .offset = @intCast(offset) };
+
+        const variations = square(@popCount(mask));
+        for (0..variations) |i| {
+            const blockers = pdep(i, mask);
+            table[offset + i] = if (is_rook) ratt(sq, blockers) else batt(sq, blockers);
+        }
+
+        offset += variations;
+    }
+
+    std.debug.assert(offset == table.len);
+}
+
+pub fn gen_pext_tables() void {
+    gen_pext(&rook_pext_table, &rook_pext, true);
+    gen_pext(&bishop_pext_table, &bishop_pext, false);
+}
+
 const WPAWN_MID_PST: [64]i16 = .{
     0,   0,   0,  0,  0,  0,   0,  0,   -35, -1, -20, -23, -15, 24, 38, -22, -26, -4, -4, -10, 3,  3,  33, -12,
     -27, -2,  -5, 12, 17, 6,   10, -25, -14, 13, 6,   21,  23,  12, 17, -23, -6,  7,  26, 31,  65, 56, 25, -20,
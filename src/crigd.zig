@@ -0,0 +1,405 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const uci = @import("uci.zig");
+const UCI = uci.UCI;
+const search = @import("search.zig");
+const movegen = @import("movegen.zig");
+const Engine = @import("engine.zig").Engine;
+
+// serves many uci sessions from one process over a unix socket, each
+// connection is its own session with its own tt and board, while the
+// searches themselves run on a fixed pool of workers
+// run with `zig build crigd -- [socket path] [options]`, see usage
+
+pub const std_options: std.Options = .{ .log_level = .info };
+
+const DEFAULT_SOCKET_PATH = "/tmp/crigd.sock";
+const LINE_BUF_SIZE = 4096;
+// readers only parse commands, searches run on the workers
+const READER_STACK_SIZE = 1 << 20;
+
+const allocator = std.heap.smp_allocator;
+
+const usage =
+    \\usage: crigd [socket path] [options]
+    \\  --workers <n>       search threads (default: cpu count)
+    \\  --max-sessions <n>  connections accepted at once (default 256)
+    \\  --max-queued <n>    searches waiting for a worker before go is refused (default 64)
+    \\  --hash <mb>         tt size each session starts with (default 16)
+    \\  --max-hash <mb>     largest Hash a session can set (default 64)
+    \\
+;
+
+const Config = struct {
+    socket_path: []const u8 = DEFAULT_SOCKET_PATH,
+    workers: usize = 0,
+    max_sessions: usize = 256,
+    max_queued: usize = 64,
+    hash_mb: usize = 16,
+    max_hash_mb: usize = 64,
+
+    fn parse(args: []const []const u8) !Config {
+        var config = Config{};
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (!std.mem.startsWith(u8, arg, "--")) {
+                config.socket_path = arg;
+                continue;
+            }
+
+            i += 1;
+            if (i == args.len) return error.MissingOptionValue;
+            const value = try std.fmt.parseInt(usize, args[i], 10);
+
+            if (std.mem.eql(u8, arg, "--workers")) {
+                config.workers = value;
+            } else if (std.mem.eql(u8, arg, "--max-sessions")) {
+                config.max_sessions = value;
+            } else if (std.mem.eql(u8, arg, "--max-queued")) {
+                config.max_queued = value;
+            } else if (std.mem.eql(u8, arg, "--hash")) {
+                config.hash_mb = value;
+            } else if (std.mem.eql(u8, arg, "--max-hash")) {
+                config.max_hash_mb = value;
+            } else {
+                return error.UnknownOption;
+            }
+        }
+
+        if (config.workers == 0) config.workers = std.Thread.getCpuCount() catch 1;
+        config.hash_mb = @min(config.hash_mb, config.max_hash_mb);
+        return config;
+    }
+};
+
+// sessions waiting for a worker, first in first out. a session only ever has
+// one search queued or running, so every client gets its turn
+const Pool = struct {
+    mutex: std.Thread.Mutex = .{},
+    cond: std.Thread.Condition = .{},
+    head: ?*Session = null,
+    tail: ?*Session = null,
+    queued: usize = 0,
+    max_queued: usize,
+
+    // false if the queue is full, the session's search is refused
+    fn submit(self: *Pool, s: *Session) bool {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        if (self.queued >= self.max_queued) return false;
+
+        s.next = null;
+        if (self.tail) |t| t.next = s else self.head = s;
+        self.tail = s;
+        self.queued += 1;
+
+        self.cond.signal();
+        return true;
+    }
+
+    fn take(self: *Pool) *Session {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        while (self.head == null) self.cond.wait(&self.mutex);
+
+        const s = self.head.?;
+        self.head = s.next;
+        if (self.head == null) self.tail = null;
+        self.queued -= 1;
+        return s;
+    }
+};
+
+const Daemon = struct {
+    config: Config,
+    pool: Pool,
+    sessions: std.atomic.Value(usize),
+
+    fn worker(self: *Daemon) void {
+        while (true) self.pool.take().run_search();
+    }
+
+    fn accept(self: *Daemon, conn: std.net.Server.Connection) void {
+        if (self.sessions.load(.monotonic) >= self.config.max_sessions) {
+            std.log.warn("refusing connection, {d} sessions already open", .{self.config.max_sessions});
+            var buf: [64]u8 = undefined;
+            var w = conn.stream.writer(&buf);
+            w.interface.writeAll("info string crigd is full, try again later\n") catch {};
+            w.interface.flush() catch {};
+            conn.stream.close();
+            return;
+        }
+
+        const s = Session.init(self, conn.stream) catch |err| {
+            std.log.err("could not start session: {s}", .{@errorName(err)});
+            conn.stream.close();
+            return;
+        };
+
+        const thread = std.Thread.spawn(.{ .stack_size = READER_STACK_SIZE }, Session.read_loop, .{s}) catch |err| {
+            std.log.err("could not start session reader: {s}", .{@errorName(err)});
+            s.deinit();
+            return;
+        };
+        thread.detach();
+    }
+};
+
+const SessionState = enum { idle, queued, searching };
+
+// once a search is queued the session belongs to the pool, a worker could
+// already be running (or have freed) it
+const Dispatched = enum { handled, queued, end };
+
+// while a search is queued or running every line but stop and quit is kept
+// in pending, the worker handles them in order once the search is done. that
+// way only one thread ever touches the uci state or writes to the socket
+const Session = struct {
+    daemon: *Daemon,
+    stream: std.net.Stream,
+    write_buf: [LINE_BUF_SIZE]u8,
+    writer: std.net.Stream.Writer,
+    engine: *Engine,
+    uci: *UCI,
+
+    mutex: std.Thread.Mutex,
+    state: SessionState,
+    // the client has gone, whoever has the session when this is seen frees it
+    closed: bool,
+    pending: std.ArrayList([]u8),
+    limits: search.Limits,
+    // the next session in the pool's queue
+    next: ?*Session,
+
+    fn init(daemon: *Daemon, stream: std.net.Stream) !*Session {
+        const s = try allocator.create(Session);
+        errdefer allocator.destroy(s);
+
+        const engine = try Engine.init(allocator, daemon.config.hash_mb);
+        errdefer engine.deinit();
+
+        s.* = .{
+            .daemon = daemon,
+            .stream = stream,
+            .write_buf = undefined,
+            .writer = undefined,
+            .engine = engine,
+            .uci = undefined,
+            .mutex = .{},
+            .state = .idle,
+            .closed = false,
+            .pending = .empty,
+            .limits = .{},
+            .next = null,
+        };
+        s.writer = stream.writer(&s.write_buf);
+        s.uci = try UCI.init(allocator, &s.writer.interface, engine, board.default_board());
+        s.uci.max_hash_mb = daemon.config.max_hash_mb;
+
+        _ = daemon.sessions.fetchAdd(1, .monotonic);
+        return s;
+    }
+
+    fn deinit(self: *Session) void {
+        for (self.pending.items) |line| allocator.free(line);
+        self.pending.deinit(allocator);
+        self.uci.deinit(allocator);
+        self.engine.deinit();
+        self.stream.close();
+        _ = self.daemon.sessions.fetchSub(1, .monotonic);
+        allocator.destroy(self);
+    }
+
+    fn read_loop(self: *Session) void {
+        var read_buf: [LINE_BUF_SIZE]u8 = undefined;
+        var stream_reader = self.stream.reader(&read_buf);
+        const reader = stream_reader.interface();
+
+        while (reader.takeDelimiterInclusive('\n')) |line| {
+            const input = std.mem.trim(u8, line, " \r\n");
+
+            // these can't wait for the search to finish
+            if (std.mem.eql(u8, input, "stop")) {
+                self.engine.stop.store(true, .monotonic);
+                continue;
+            }
+            if (std.mem.eql(u8, input, "quit")) break;
+
+            self.mutex.lock();
+            if (self.state != .idle) {
+                const owned = allocator.dupe(u8, input) catch {
+                    self.mutex.unlock();
+                    break;
+                };
+                self.pending.append(allocator, owned) catch {
+                    allocator.free(owned);
+                    self.mutex.unlock();
+                    break;
+                };
+                self.mutex.unlock();
+                continue;
+            }
+            self.mutex.unlock();
+
+            if (self.dispatch(input) == .end) break;
+        } else |err| switch (err) {
+            error.EndOfStream => {},
+            else => std.log.warn("session read failed: {s}", .{@errorName(err)}),
+        }
+
+        self.close();
+    }
+
+    fn close(self: *Session) void {
+        self.engine.stop.store(true, .monotonic);
+
+        self.mutex.lock();
+        self.closed = true;
+        const idle = self.state == .idle;
+        self.mutex.unlock();
+
+        // otherwise the worker frees it once the search has stopped
+        if (idle) self.deinit();
+    }
+
+    // handles a line while no search is running, go is queued for a worker
+    fn dispatch(self: *Session, input: []const u8) Dispatched {
+        if (std.mem.eql(u8, input, "go") or std.mem.startsWith(u8, input, "go ")) {
+            const queued = self.queue_search(input) catch |err| {
+                std.log.warn("session write failed: {s}", .{@errorName(err)});
+                return .end;
+            };
+            return if (queued) .queued else .handled;
+        }
+
+        const keep_going = self.uci.handle_line(input) catch |err| {
+            std.log.warn("session command failed: {s}", .{@errorName(err)});
+            return .end;
+        };
+        return if (keep_going) .handled else .end;
+    }
+
+    // false if the search was refused (or the go was invalid)
+    fn queue_search(self: *Session, input: []const u8) !bool {
+        self.limits = uci.parse_go_limits(input, self.uci.board.ctm) catch |err| {
+            try self.uci.log_uci_error("Invalid go command '{s}': {s}", .{ input, @errorName(err) });
+            return false;
+        };
+        self.engine.stop.store(false, .monotonic);
+
+        // set before submitting, a worker could pick the search up (and even
+        // finish it) before submit returns
+        self.mutex.lock();
+        const prev_state = self.state;
+        self.state = .queued;
+        self.mutex.unlock();
+
+        if (self.daemon.pool.submit(self)) return true;
+
+        self.mutex.lock();
+        self.state = prev_state;
+        self.mutex.unlock();
+
+        const w = &self.writer.interface;
+        try w.print("info string all workers are busy, try again later\nbestmove 0000\n", .{});
+        try w.flush();
+        return false;
+    }
+
+    // runs on a worker
+    fn run_search(self: *Session) void {
+        self.mutex.lock();
+        if (self.closed) {
+            self.mutex.unlock();
+            self.deinit();
+            return;
+        }
+        self.state = .searching;
+        self.mutex.unlock();
+
+        self.uci.search_and_report(self.limits) catch |err| {
+            std.log.warn("session search failed: {s}", .{@errorName(err)});
+            // the client is still waiting for a bestmove, if it has gone the
+            // reader will notice
+            const w = &self.writer.interface;
+            w.print("bestmove 0000\n", .{}) catch {};
+            w.flush() catch {};
+        };
+
+        self.finish_search();
+    }
+
+    // handles everything that came in during the search, stopping early if
+    // another search gets queued
+    fn finish_search(self: *Session) void {
+        while (true) {
+            self.mutex.lock();
+            if (self.closed) {
+                self.mutex.unlock();
+                self.deinit();
+                return;
+            }
+            if (self.pending.items.len == 0) {
+                self.state = .idle;
+                self.mutex.unlock();
+                return;
+            }
+            const line = self.pending.orderedRemove(0);
+            self.mutex.unlock();
+
+            // a failed write means the client has gone, the reader will
+            // notice and mark the session closed
+            const res = self.dispatch(line);
+            allocator.free(line);
+            if (res == .queued) return;
+        }
+    }
+};
+
+pub fn main() !void {
+    movegen.detect_cpu_features();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    const config = Config.parse(args[1..]) catch |err| {
+        std.debug.print("{s}\n{s}", .{ @errorName(err), usage });
+        return err;
+    };
+
+    std.fs.cwd().deleteFile(config.socket_path) catch |err| switch (err) {
+        error.FileNotFound => {},
+        else => return err,
+    };
+
+    const address = try std.net.Address.initUnix(config.socket_path);
+    var server = try address.listen(.{});
+    defer server.deinit();
+
+    const daemon = try allocator.create(Daemon);
+    defer allocator.destroy(daemon);
+    daemon.* = .{
+        .config = config,
+        .pool = .{ .max_queued = config.max_queued },
+        .sessions = std.atomic.Value(usize).init(0),
+    };
+
+    for (0..config.workers) |_| {
+        const thread = try std.Thread.spawn(.{}, Daemon.worker, .{daemon});
+        thread.detach();
+    }
+
+    std.log.info("crigd listening on {s} with {d} workers", .{ config.socket_path, config.workers });
+
+    while (true) {
+        const conn = server.accept() catch |err| {
+            std.log.err("accept failed: {s}", .{@errorName(err)});
+            continue;
+        };
+        daemon.accept(conn);
+    }
+}
@@ -0,0 +1,336 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const movegen = @import("movegen.zig");
+const Move = movegen.Move;
+const search = @import("search.zig");
+const eval = @import("eval.zig");
+const UCI = @import("uci.zig").UCI;
+const Engine = @import("engine.zig").Engine;
+
+// plays fixed node self-play games on every core and writes the quiet
+// positions, with their search score and the game's result, as PackedPos
+// run with `zig build datagen -- <out file> [options]`, see usage
+
+pub const std_options: std.Options = .{ .log_level = .info };
+
+const usage =
+    \\usage: datagen <out file> [options]
+    \\  --threads <n>    games played at once (default: cpu count)
+    \\  --positions <n>  stop after writing this many positions (default 100000000)
+    \\  --nodes <n>      nodes searched per move (default 5000)
+    \\  --seed <n>       seed for the random openings (default: time)
+    \\
+;
+
+// random moves played from startpos before the engine takes over, and how
+// unbalanced the result can be before the opening is thrown away
+const RANDOM_PLIES_MIN = 8;
+const RANDOM_PLIES_MAX = 9;
+const MAX_OPENING_SCORE = 400;
+
+// games are called once the search is this sure for this many plies
+const WIN_SCORE = 2000;
+const WIN_PLIES = 6;
+const MAX_GAME_PLIES = 400;
+
+// positions are kept once the engine is past the random moves
+const SKIP_PLIES = 16;
+
+// each thread writes this many positions at a time
+const FLUSH_POSITIONS = 1 << 16;
+
+const TT_MB = 16;
+
+const allocator = std.heap.smp_allocator;
+
+pub const Result = enum(u2) { black_win = 0, draw = 1, white_win = 2 };
+
+// 32 bytes per position, in the native byte order. the occupied squares and
+// then a nibble per piece (its Piece value) in square order, a1 first
+pub const PackedPos = extern struct {
+    occ: u64,
+    pieces: [16]u8,
+    // the search score, from white's point of view
+    score: i16,
+    info: packed struct(u8) { ctm: u1, result: Result, _pad: u5 = 0 },
+    castling: u8,
+    ep: u8,
+    halfmove: u8,
+    // plies from startpos, the random opening included
+    ply: u16,
+
+    fn new(b: *const Board, white_score: i32, ply: usize) PackedPos {
+        var pos = PackedPos{
+            .occ = b.all_bb(),
+            .pieces = [_]u8{0} ** 16,
+            .score = @intCast(std.math.clamp(white_score, std.math.minInt(i16), std.math.maxInt(i16))),
+            .info = .{ .ctm = @intCast(@intFromEnum(b.ctm)), .result = .draw },
+            .castling = b.castling,
+            .ep = b.ep,
+            .halfmove = b.halfmove,
+            .ply = @intCast(@min(ply, std.math.maxInt(u16))),
+        };
+
+        var occ = pos.occ;
+        var i: usize = 0;
+        while (occ > 0) : ({
+            occ &= occ - 1;
+            i += 1;
+        }) {
+            const p: u8 = @intFromEnum(b.get_piece(@ctz(occ)));
+            pos.pieces[i / 2] |= p << @intCast(4 * (i % 2));
+        }
+
+        return pos;
+    }
+};
+
+comptime {
+    std.debug.assert(@sizeOf(PackedPos) == 32);
+}
+
+const Config = struct {
+    out_path: ?[]const u8 = null,
+    threads: usize = 0,
+    positions: usize = 100_000_000,
+    nodes: usize = 5000,
+    seed: ?u64 = null,
+
+    fn parse(args: []const []const u8) !Config {
+        var config = Config{};
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (!std.mem.startsWith(u8, arg, "--")) {
+                config.out_path = arg;
+                continue;
+            }
+
+            i += 1;
+            if (i == args.len) return error.MissingOptionValue;
+            const value = try std.fmt.parseInt(u64, args[i], 10);
+
+            if (std.mem.eql(u8, arg, "--threads")) {
+                config.threads = value;
+            } else if (std.mem.eql(u8, arg, "--positions")) {
+                config.positions = value;
+            } else if (std.mem.eql(u8, arg, "--nodes")) {
+                config.nodes = value;
+            } else if (std.mem.eql(u8, arg, "--seed")) {
+                config.seed = value;
+            } else {
+                return error.UnknownOption;
+            }
+        }
+
+        if (config.out_path == null) return error.NoOutFile;
+        if (config.threads == 0) config.threads = std.Thread.getCpuCount() catch 1;
+        return config;
+    }
+};
+
+const Output = struct {
+    file: std.fs.File,
+    mutex: std.Thread.Mutex,
+    written: std.atomic.Value(usize),
+    target: usize,
+    timer: std.time.Timer,
+
+    fn done(self: *Output) bool {
+        return self.written.load(.monotonic) >= self.target;
+    }
+
+    // one big sequential write per call, threads take turns
+    fn write(self: *Output, positions: []const PackedPos) !void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        try self.file.writeAll(std.mem.sliceAsBytes(positions));
+        const total = self.written.fetchAdd(positions.len, .monotonic) + positions.len;
+
+        const hours = @as(f64, @floatFromInt(self.timer.read())) / @as(f64, @floatFromInt(std.time.ns_per_hour));
+        std.debug.print("{d} positions, {d:.0} per hour\n", .{ total, @as(f64, @floatFromInt(total)) / hours });
+    }
+};
+
+fn no_moves(b: *const Board) bool {
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
+    return ml.count == 0;
+}
+
+fn is_mate_score(score: i32) bool {
+    return @abs(score) >= eval.CHECKMATE - search.MAX_DEPTH;
+}
+
+const Worker = struct {
+    out: *Output,
+    config: *const Config,
+    rng: std.Random.DefaultPrng,
+    engine: *Engine,
+    uci: *UCI,
+    discard: std.Io.Writer.Discarding,
+    // positions from the game being played, waiting on its result
+    game: std.ArrayList(PackedPos),
+    buf: std.ArrayList(PackedPos),
+
+    fn run(out: *Output, config: *const Config, seed: u64) void {
+        const w = allocator.create(Worker) catch |err| {
+            std.log.err("datagen worker failed: {s}", .{@errorName(err)});
+            return;
+        };
+        defer allocator.destroy(w);
+
+        w.play(out, config, seed) catch |err| {
+            std.log.err("datagen worker failed: {s}", .{@errorName(err)});
+        };
+    }
+
+    fn play(self: *Worker, out: *Output, config: *const Config, seed: u64) !void {
+        var discard_buf: [256]u8 = undefined;
+        self.* = .{
+            .out = out,
+            .config = config,
+            .rng = std.Random.DefaultPrng.init(seed),
+            .engine = try Engine.init(allocator, TT_MB),
+            .uci = undefined,
+            .discard = std.Io.Writer.Discarding.init(&discard_buf),
+            .game = .empty,
+            .buf = try .initCapacity(allocator, FLUSH_POSITIONS),
+        };
+        defer self.engine.deinit();
+        defer self.game.deinit(allocator);
+        defer self.buf.deinit(allocator);
+
+        // search info goes nowhere
+        self.uci = try UCI.init(allocator, &self.discard.writer, self.engine, board.default_board());
+        defer self.uci.deinit(allocator);
+
+        while (!out.done()) {
+            const result = try self.play_game();
+            for (self.game.items) |*pos| pos.info.result = result;
+
+            try self.buf.appendSlice(allocator, self.game.items);
+            if (self.buf.items.len >= FLUSH_POSITIONS) {
+                try out.write(self.buf.items);
+                self.buf.clearRetainingCapacity();
+            }
+        }
+
+        if (self.buf.items.len > 0) try out.write(self.buf.items);
+    }
+
+    fn search_move(self: *Worker) !search.SearchResult {
+        return search.do_search(self.uci, .{
+            .movetime_ms = std.math.maxInt(u64),
+            .nodes = self.config.nodes,
+        });
+    }
+
+    fn make(self: *Worker, m: Move) void {
+        var next: Board = undefined;
+        self.uci.board.copy_make(&next, m);
+        self.uci.board = next;
+        self.engine.reps.push(next.hash);
+    }
+
+    // plays random moves from startpos until it finds an opening that isn't
+    // already over or lost, returns how many plies it is
+    fn random_opening(self: *Worker) !usize {
+        const r = self.rng.random();
+        while (true) {
+            self.engine.new_game();
+            self.uci.board = board.default_board();
+            self.engine.reps.push(self.uci.board.hash);
+
+            const plies = r.intRangeAtMost(usize, RANDOM_PLIES_MIN, RANDOM_PLIES_MAX);
+            var ok = true;
+            for (0..plies) |_| {
+                var ml = movegen.MoveList.new(&self.uci.board, null, null);
+                movegen.gen_moves(&ml);
+                if (ml.count == 0) {
+                    ok = false;
+                    break;
+                }
+                // the list only hands out moves in order, skip to a random one
+                var m = ml.next().?;
+                for (0..r.uintLessThan(usize, ml.count)) |_| m = ml.next().?;
+                self.make(m);
+            }
+            if (!ok or no_moves(&self.uci.board)) continue;
+
+            const res = try self.search_move();
+            if (@abs(res.score) <= MAX_OPENING_SCORE) return plies;
+        }
+    }
+
+    fn play_game(self: *Worker) !Result {
+        self.game.clearRetainingCapacity();
+        const opening_plies = try self.random_opening();
+
+        var win_plies: usize = 0;
+        // counted from the end of the opening
+        var ply: usize = 0;
+        while (ply < MAX_GAME_PLIES) : (ply += 1) {
+            const b = &self.uci.board;
+            if (no_moves(b)) {
+                if (!b.is_in_check()) return .draw;
+                return if (b.ctm == .WHITE) .black_win else .white_win;
+            }
+            if (self.engine.reps.is_draw(b)) return .draw;
+
+            const res = try self.search_move();
+            const white_score = if (b.ctm == .WHITE) res.score else -res.score;
+
+            // the search is sure enough to call it
+            win_plies = if (@abs(res.score) >= WIN_SCORE) win_plies + 1 else 0;
+            if (win_plies >= WIN_PLIES) return if (white_score > 0) .white_win else .black_win;
+
+            // quiet positions only, a capture or check would just be
+            // resolved by the next move
+            const quiet = !b.is_in_check() and !res.move.mt.is_cap() and !res.move.mt.is_promo();
+            if (ply >= SKIP_PLIES and quiet and !is_mate_score(res.score)) {
+                try self.game.append(allocator, PackedPos.new(b, white_score, opening_plies + ply));
+            }
+
+            self.make(res.move);
+        }
+
+        return .draw;
+    }
+};
+
+pub fn main() !void {
+    movegen.detect_cpu_features();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    const config = Config.parse(args[1..]) catch |err| {
+        std.debug.print("{s}\n{s}", .{ @errorName(err), usage });
+        return err;
+    };
+
+    const file = try std.fs.cwd().createFile(config.out_path.?, .{});
+    defer file.close();
+
+    var out = Output{
+        .file = file,
+        .mutex = .{},
+        .written = std.atomic.Value(usize).init(0),
+        .target = config.positions,
+        .timer = try std.time.Timer.start(),
+    };
+
+    const seed = config.seed orelse @as(u64, @bitCast(std.time.milliTimestamp()));
+    const threads = try allocator.alloc(std.Thread, config.threads);
+    defer allocator.free(threads);
+    for (threads, 0..) |*t, i| {
+        t.* = try std.Thread.spawn(.{}, Worker.run, .{ &out, &config, seed +% i });
+    }
+    for (threads) |t| t.join();
+
+    std.debug.print("wrote {d} positions to {s}\n", .{ out.written.load(.monotonic), config.out_path.? });
+}
@@ -0,0 +1,199 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const Piece = board.Piece;
+const Colour = board.Colour;
+const File = board.File;
+const eval = @import("eval.zig");
+const consts = @import("consts");
+
+// recognises endgames whose result is already known, so the search doesn't
+// have to rediscover it: dead draws, king and pawn against king (from the
+// kpk bitbase generated by buildtime_consts), a bishop with the wrong colour
+// for its rook pawns, and the basic mates
+
+// anything with more pieces than this (kings included) isn't recognised
+const MAX_PIECES = 6;
+
+// well clear of any normal eval, and well below the mate scores
+pub const KNOWN_WIN: i32 = 10000;
+pub const DRAW: i32 = eval.STALEMATE;
+
+const Material = struct {
+    pawns: u8,
+    knights: u8,
+    bishops: u8,
+    rooks: u8,
+    queens: u8,
+
+    fn new(b: *const Board, c: Colour) Material {
+        return .{
+            .pawns = @popCount(b.piece_bb(.PAWN, c)),
+            .knights = @popCount(b.piece_bb(.KNIGHT, c)),
+            .bishops = @popCount(b.piece_bb(.BISHOP, c)),
+            .rooks = @popCount(b.piece_bb(.ROOK, c)),
+            .queens = @popCount(b.piece_bb(.QUEEN, c)),
+        };
+    }
+
+    fn is_bare(self: Material) bool {
+        return self.pawns + self.knights + self.bishops + self.rooks + self.queens == 0;
+    }
+
+    // no pawns and at most one minor piece, can't mate even with help
+    fn is_lone_minor(self: Material) bool {
+        return self.pawns + self.rooks + self.queens == 0 and self.knights + self.bishops <= 1;
+    }
+
+    fn value(self: Material) i32 {
+        return self.pawns * eval.PAWN_VALUE + self.knights * eval.PIECE_VALS[@intFromEnum(Piece.KNIGHT)] +
+            self.bishops * eval.PIECE_VALS[@intFromEnum(Piece.BISHOP)] + self.rooks * eval.PIECE_VALS[@intFromEnum(Piece.ROOK)] +
+            self.queens * eval.QUEEN_VALUE;
+    }
+};
+
+// the score of a recognised endgame from the side to move's point of view,
+// null if the position isn't one of them
+pub fn probe(b: *const Board) ?i32 {
+    if (@popCount(b.all_bb()) > MAX_PIECES) {
+        @branchHint(.likely);
+        return null;
+    }
+
+    const white = Material.new(b, .WHITE);
+    const black = Material.new(b, .BLACK);
+
+    if (white.is_lone_minor() and black.is_lone_minor()) return DRAW;
+
+    var strong: Colour = .WHITE;
+    if (white.is_bare()) {
+        strong = .BLACK;
+    } else if (!black.is_bare()) {
+        return null;
+    }
+
+    const score = probe_strong(b, strong, if (strong == .WHITE) white else black) orelse return null;
+    return if (b.ctm == strong) score else -score;
+}
+
+// true if the position is a draw whatever either side does: too little
+// material left to mate, or a kpk draw in the bitbase. the other draws that
+// probe scores (two minors, the wrong bishop) can still have a mate or a win
+// in a corner, so they are only scored by the eval, never cut off
+pub fn known_draw(b: *const Board) bool {
+    const pieces = @popCount(b.all_bb());
+    if (pieces > 3) {
+        @branchHint(.likely);
+        return false;
+    }
+    if (pieces == 2) return true;
+
+    const minors = b.piece_bb(.KNIGHT, .WHITE) | b.piece_bb(.KNIGHT, .BLACK) |
+        b.piece_bb(.BISHOP, .WHITE) | b.piece_bb(.BISHOP, .BLACK);
+    if (minors > 0) return true;
+
+    if (b.piece_bb(.PAWN, .WHITE) > 0) return !kpk_wins(b, .WHITE);
+    if (b.piece_bb(.PAWN, .BLACK) > 0) return !kpk_wins(b, .BLACK);
+    return false;
+}
+
+// the weak side only has its king, scored from strong's point of view
+fn probe_strong(b: *const Board, strong: Colour, m: Material) ?i32 {
+    const strong_king: usize = @ctz(b.piece_bb(.KING, strong));
+    const weak_king: usize = @ctz(b.piece_bb(.KING, strong.opp()));
+
+    // knights can't force mate on their own
+    if (m.pawns + m.bishops + m.rooks + m.queens == 0 and m.knights <= 2) return DRAW;
+
+    if (m.rooks + m.queens > 0) {
+        return KNOWN_WIN + m.value() + 20 * edge_closeness(weak_king) + 10 * (7 - sq_distance(strong_king, weak_king));
+    }
+
+    if (m.pawns == 1 and m.knights + m.bishops == 0) {
+        if (!kpk_wins(b, strong)) return DRAW;
+        const pawn_rank = relative_rank(@ctz(b.piece_bb(.PAWN, strong)), strong);
+        return KNOWN_WIN + eval.PAWN_VALUE + 10 * @as(i32, @intCast(pawn_rank));
+    }
+
+    if (m.pawns == 0 and m.bishops == 1 and m.knights == 1) {
+        return KNOWN_WIN + kbnk_score(b, strong, strong_king, weak_king);
+    }
+
+    if (m.pawns > 0 and m.bishops == 1 and m.knights == 0 and wrong_bishop(b, strong, weak_king)) return DRAW;
+
+    return null;
+}
+
+// kbnk is only mated in a corner the bishop can reach, so the weak king is
+// pushed to the nearer of those and the strong king brought up behind it
+fn kbnk_score(b: *const Board, strong: Colour, strong_king: usize, weak_king: usize) i32 {
+    const bishop: usize = @ctz(b.piece_bb(.BISHOP, strong));
+    const corners: [2]usize = if (is_dark(bishop)) .{ 0, 63 } else .{ 7, 56 };
+    const corner_dist = @min(sq_distance(weak_king, corners[0]), sq_distance(weak_king, corners[1]));
+    return 32 * (7 - corner_dist) + 8 * (7 - sq_distance(strong_king, weak_king));
+}
+
+// rook pawns with a bishop that can't cover the queening square, and the
+// defending king already on or next to that square
+fn wrong_bishop(b: *const Board, strong: Colour, weak_king: usize) bool {
+    const pawns = b.piece_bb(.PAWN, strong);
+    const file: usize = if (pawns & ~@intFromEnum(File.FA) == 0) 0 else if (pawns & ~@intFromEnum(File.FH) == 0) 7 else return false;
+
+    const queening: usize = if (strong == .WHITE) 56 + file else file;
+    const bishop: usize = @ctz(b.piece_bb(.BISHOP, strong));
+    if (is_dark(bishop) == is_dark(queening)) return false;
+
+    return sq_distance(weak_king, queening) <= 1;
+}
+
+// must match buildtime_consts.kpk_index
+fn kpk_index(stm: usize, wk: usize, bk: usize, psq: usize) usize {
+    const pawn_idx = (psq / 8 - 1) * 4 + psq % 8;
+    return stm * 24 * 4096 + pawn_idx * 4096 + wk * 64 + bk;
+}
+
+// the bitbase only has white pawns on files a-d, so the board is flipped to
+// make strong white and mirrored to put the pawn on the queenside
+fn kpk_wins(b: *const Board, strong: Colour) bool {
+    var wk: usize = @ctz(b.piece_bb(.KING, strong));
+    var bk: usize = @ctz(b.piece_bb(.KING, strong.opp()));
+    var psq: usize = @ctz(b.piece_bb(.PAWN, strong));
+
+    if (strong == .BLACK) {
+        wk ^= 56;
+        bk ^= 56;
+        psq ^= 56;
+    }
+
+    if (psq % 8 >= 4) {
+        wk ^= 7;
+        bk ^= 7;
+        psq ^= 7;
+    }
+
+    const stm: usize = if (b.ctm == strong) 0 else 1;
+    const idx = kpk_index(stm, wk, bk, psq);
+    return consts.kpk_bitbase[idx / 64] & board.square(idx % 64) > 0;
+}
+
+fn is_dark(sq: usize) bool {
+    return (sq / 8 + sq % 8) % 2 == 0;
+}
+
+fn relative_rank(sq: usize, c: Colour) usize {
+    return if (c == .WHITE) sq / 8 else 7 - sq / 8;
+}
+
+fn sq_distance(a: usize, b: usize) i32 {
+    const file_dist = @abs(@as(i32, @intCast(a % 8)) - @as(i32, @intCast(b % 8)));
+    const rank_dist = @abs(@as(i32, @intCast(a / 8)) - @as(i32, @intCast(b / 8)));
+    return @intCast(@max(file_dist, rank_dist));
+}
+
+// 0 in the centre up to 6 in a corner
+fn edge_closeness(sq: usize) i32 {
+    const file: i32 = @intCast(sq % 8);
+    const rank: i32 = @intCast(sq / 8);
+    return @max(3 - file, file - 4) + @max(3 - rank, rank - 4);
+}
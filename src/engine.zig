@@ -0,0 +1,69 @@
+const std = @import("std");
+
+const tt = @import("tt.zig");
+const TT = tt.TT;
+const movegen = @import("movegen.zig");
+const Repetitions = movegen.Repetitions;
+const trace = @import("trace.zig");
+
+// Everything a search mutates lives in here rather than in globals, so that
+// several engines (eg. multiple UCI instances from the app, or many sessions
+// on a server) can search in the same process without stepping on each other
+pub const Engine = struct {
+    allocator: std.mem.Allocator,
+    tt: TT,
+    reps: Repetitions,
+    // set from any thread to make the current search return as soon as it
+    // next checks the clock
+    stop: std.atomic.Value(bool),
+    // only ever set in -Dtrace=true builds
+    tracer: ?*trace.Recorder,
+
+    pub fn init(allocator: std.mem.Allocator, tt_mb: usize) !*Engine {
+        movegen.detect_cpu_features();
+
+        const e = try allocator.create(Engine);
+        errdefer allocator.destroy(e);
+
+        e.* = .{
+            .allocator = allocator,
+            .tt = try TT.init(allocator, tt_mb),
+            .reps = undefined,
+            .stop = std.atomic.Value(bool).init(false),
+            .tracer = null,
+        };
+        e.reps.clear();
+
+        return e;
+    }
+
+    pub fn deinit(self: *Engine) void {
+        if (self.tracer) |t| t.stop();
+        self.tt.deinit(self.allocator);
+        self.allocator.destroy(self);
+    }
+
+    // reallocates the transposition table with a new memory budget, the
+    // contents of the old table are lost
+    pub fn resize_tt(self: *Engine, tt_mb: usize) !void {
+        const new_tt = try TT.init(self.allocator, tt_mb);
+        self.tt.deinit(self.allocator);
+        self.tt = new_tt;
+    }
+
+    // starts recording every node searched to path, or stops recording if
+    // path is null
+    pub fn set_trace_file(self: *Engine, path: ?[]const u8) !void {
+        if (comptime !trace.enabled) return error.TracingNotEnabled;
+
+        if (self.tracer) |t| t.stop();
+        self.tracer = null;
+
+        if (path) |p| self.tracer = try trace.Recorder.start(self.allocator, p);
+    }
+
+    pub fn new_game(self: *Engine) void {
+        self.tt.clear();
+        self.reps.clear();
+    }
+};
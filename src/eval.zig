@@ -7,8 +7,10 @@ const BB = board.BB;
 const Colour = board.Colour;
 const movegen = @import("movegen.zig");
 const Move = movegen.Move;
+const AttackMaps = movegen.AttackMaps;
 const consts = @import("consts");
 const util = @import("util.zig");
+const endgame = @import("endgame.zig");
 
 pub const INF: i32 = 1000000;
 pub const CHECKMATE: i32 = 100000;
@@ -93,11 +95,100 @@ fn tapered_eval(mg: i32, eg: i32, phase: u8) i32 {
     return @divTrunc(mg * mg_phase + eg * eg_phase, 24);
 }
 
+// known endgames (see endgame.zig) are scored by what they are worth
 pub fn eval(b: *const Board) i32 {
+    if (endgame.probe(b)) |score| return score;
+    return material_eval(b);
+}
+
+fn material_eval(b: *const Board) i32 {
     const mul: i32 = if (b.ctm == .WHITE) 1 else -1;
     return tapered_eval(b.mg_val, b.eg_val, b.phase) * mul;
 }
 
+// when the cheap eval is this far outside the window the attack terms won't
+// bring it back in, so the attack maps aren't built
+pub const LAZY_EVAL_MARGIN: i32 = 250;
+
+// per safe square, centred on a typical count for that piece so that an
+// average position scores about nothing, in MOBILITY_PIECES order
+const MOBILITY_MG = [4]i32{ 4, 4, 2, 1 };
+const MOBILITY_EG = [4]i32{ 4, 5, 4, 2 };
+const MOBILITY_BASE = [4]i32{ 4, 6, 6, 12 };
+
+// one piece on its own near the king isn't much of an attack, scaled up
+// (in percent) as more pieces join in
+const KING_ATTACKERS_SCALE = [8]i32{ 0, 0, 50, 75, 88, 94, 97, 99 };
+const KING_ZONE_HIT_MG: i32 = 20;
+
+// pieces the opponent attacks that nothing defends
+const HANGING_MG: i32 = 30;
+const HANGING_EG: i32 = 20;
+// pieces (other than pawns) that an enemy pawn attacks
+const PAWN_THREAT_MG: i32 = 40;
+const PAWN_THREAT_EG: i32 = 30;
+
+// the material and pst eval comes for free with the board, the attack terms
+// are only added (and the maps only built) if they could bring the score
+// back inside alpha and beta. maps is set when they are built, so the
+// caller can hand them to the move list
+pub fn lazy_eval(b: *const Board, alpha: i32, beta: i32, maps: *?AttackMaps) i32 {
+    if (endgame.probe(b)) |score| return score;
+
+    const val = material_eval(b);
+    if (val + LAZY_EVAL_MARGIN <= alpha or val - LAZY_EVAL_MARGIN >= beta) return val;
+
+    maps.* = AttackMaps.new(b);
+    return val + attack_eval(b, &maps.*.?);
+}
+
+// mobility, king zone attacks and threats, from the side to move's view
+pub fn attack_eval(b: *const Board, maps: *const AttackMaps) i32 {
+    const mg = attack_terms_mg(b, maps, .WHITE) - attack_terms_mg(b, maps, .BLACK);
+    const eg = attack_terms_eg(b, maps, .WHITE) - attack_terms_eg(b, maps, .BLACK);
+    const mul: i32 = if (b.ctm == .WHITE) 1 else -1;
+    return tapered_eval(mg, eg, b.phase) * mul;
+}
+
+fn mobility_score(maps: *const AttackMaps, b: *const Board, c: Colour, comptime weights: [4]i32) i32 {
+    var score: i32 = 0;
+    inline for (movegen.MOBILITY_PIECES, 0..) |p, i| {
+        const count: i32 = @popCount(b.piece_bb(p, c));
+        const mobility: i32 = maps.mobility[@intFromEnum(c)][i];
+        score += weights[i] * (mobility - MOBILITY_BASE[i] * count);
+    }
+    return score;
+}
+
+// undefended pieces under attack, and pieces attacked by pawns
+fn threats(b: *const Board, maps: *const AttackMaps, c: Colour) struct { u32, u32 } {
+    const opp = c.opp();
+    const pieces = b.col_bb(c) & ~b.piece_bb(.KING, c);
+    const hanging = pieces & maps.colour(opp) & ~maps.colour(c);
+    const pawn_threats = (pieces & ~b.piece_bb(.PAWN, c)) & maps.piece(Piece.PAWN.with_ctm(opp));
+    return .{ @popCount(hanging), @popCount(pawn_threats) };
+}
+
+fn attack_terms_mg(b: *const Board, maps: *const AttackMaps, c: Colour) i32 {
+    var score = mobility_score(maps, b, c, MOBILITY_MG);
+
+    const ci = @intFromEnum(c);
+    const attackers = @min(maps.king_attackers[ci], KING_ATTACKERS_SCALE.len - 1);
+    score += @divTrunc(KING_ZONE_HIT_MG * maps.king_zone_hits[ci] * KING_ATTACKERS_SCALE[attackers], 100);
+
+    const hanging, const pawn_threats = threats(b, maps, c);
+    score -= HANGING_MG * @as(i32, @intCast(hanging)) + PAWN_THREAT_MG * @as(i32, @intCast(pawn_threats));
+    return score;
+}
+
+fn attack_terms_eg(b: *const Board, maps: *const AttackMaps, c: Colour) i32 {
+    var score = mobility_score(maps, b, c, MOBILITY_EG);
+
+    const hanging, const pawn_threats = threats(b, maps, c);
+    score -= HANGING_EG * @as(i32, @intCast(hanging)) + PAWN_THREAT_EG * @as(i32, @intCast(pawn_threats));
+    return score;
+}
+
 pub fn eval_board_full(b: *const Board) struct { i32, i32, u8 } {
     var mg_val: i32 = 0;
     var eg_val: i32 = 0;
@@ -123,7 +214,9 @@ pub fn board_score(b: *const Board) i32 {
 
 const PROMO_MOVE_SCORE = 5000;
 pub const CAP_MOVE_SCORE = 10000;
-const TT_BEST_SCORE = 1000000;
+// captures that lose material are moved below all of the quiet moves
+pub const BAD_CAP_MOVE_SCORE = -CAP_MOVE_SCORE;
+pub const TT_BEST_SCORE = 1000000;
 const PV_BEST_SCORE = 1000001;
 
 fn least_valuable_attacker(b: *const Board, attackers: BB, ctm: Colour) struct { BB, Piece } {
@@ -199,11 +292,142 @@ pub fn see(b: *const Board, from: usize, to: usize, piece: Piece, xpiece: Piece)
     return scores[0];
 }
 
+// the order that pieces should be used to capture with, least valuable first
+const SEE_ORDER = [6]Piece{ .PAWN, .KNIGHT, .BISHOP, .ROOK, .QUEEN, .KING };
+
+// returns true if the static exchange on m's to square is worth at least
+// threshold for the side to move. unlike see this bails out as soon as the
+// answer is known, rather than building the whole swap list
+// loosely based on https://www.chessprogramming.org/SEE_-_The_Swap_Algorithm
+// pinned pieces only recapture along their pin, the pins are taken from the
+// position before the exchange so a pin isn't lifted by its pinner trading off
+// maps are the node's attack maps if the eval built them
+pub fn see_ge(b: *const Board, m: Move, threshold: i32, maps: ?*const AttackMaps) bool {
+    switch (m.mt) {
+        .WKINGSIDE, .BKINGSIDE, .WQUEENSIDE, .BQUEENSIDE => return threshold <= 0,
+        else => {},
+    }
+
+    const from: usize = m.from;
+    const to: usize = m.to;
+    const piece = m.moved_piece(b);
+    const xpiece = m.captured_piece(b);
+
+    // what we win straight away, and what the piece that now sits on the
+    // to square is worth
+    var gain: i32 = if (xpiece == .NONE) 0 else PIECE_VALS[@intFromEnum(xpiece)];
+    var on_sq: i32 = PIECE_VALS[@intFromEnum(piece)];
+    if (m.mt.is_promo()) {
+        const promo_val = PIECE_VALS[@intFromEnum(m.mt.promo_piece())];
+        gain += promo_val - PAWN_VALUE;
+        on_sq = promo_val;
+    }
+
+    // even if the opponent doesn't recapture this isn't enough
+    var swap = gain - threshold;
+    if (swap < 0) return false;
+
+    // even if the piece is lost for nothing this is still enough
+    swap = on_sq - swap;
+    if (swap <= 0) return true;
+
+    // the opponent can't recapture, moving the piece can only let through
+    // a slider that already hits the from square (and ep uncovers another
+    // square, so isn't worth checking)
+    if (maps) |am| {
+        const opp = b.ctm.opp();
+        if (m.mt != .EP and am.colour(opp) & board.square(to) == 0 and
+            am.by_sliders[@intFromEnum(opp)] & board.square(from) == 0) return true;
+    }
+
+    var occ = b.all_bb() ^ board.square(from) ^ board.square(to);
+    if (m.mt == .EP) {
+        occ ^= board.square(to - 8 + (@as(usize, @intFromEnum(b.ctm)) * 16));
+    }
+
+    const rook_likes = b.pieces[@intFromEnum(Piece.ROOK)] | b.pieces[@intFromEnum(Piece.ROOK_B)] |
+        b.pieces[@intFromEnum(Piece.QUEEN)] | b.pieces[@intFromEnum(Piece.QUEEN_B)];
+    const bishop_likes = b.pieces[@intFromEnum(Piece.BISHOP)] | b.pieces[@intFromEnum(Piece.BISHOP_B)] |
+        b.pieces[@intFromEnum(Piece.QUEEN)] | b.pieces[@intFromEnum(Piece.QUEEN_B)];
+
+    var attackers: BB = 0;
+    attackers |= movegen.pawn_att(to, .BLACK) & b.pieces[@intFromEnum(Piece.PAWN)];
+    attackers |= movegen.pawn_att(to, .WHITE) & b.pieces[@intFromEnum(Piece.PAWN_B)];
+    attackers |= movegen.knight_move(to) & (b.pieces[@intFromEnum(Piece.KNIGHT)] | b.pieces[@intFromEnum(Piece.KNIGHT_B)]);
+    attackers |= movegen.king_move(to) & (b.pieces[@intFromEnum(Piece.KING)] | b.pieces[@intFromEnum(Piece.KING_B)]);
+    attackers |= movegen.lookup_rook(occ, to) & rook_likes;
+    attackers |= movegen.lookup_bishop(occ, to) & bishop_likes;
+
+    const stuck = [2]BB{
+        movegen.pinned_away_from(b, .WHITE, to),
+        movegen.pinned_away_from(b, .BLACK, to),
+    };
+
+    var ctm = b.ctm;
+    // true while the side that made m is winning the exchange
+    var res = true;
+
+    while (true) {
+        ctm = ctm.opp();
+        attackers &= occ;
+
+        const ctm_attackers = attackers & b.col_bb(ctm) & ~stuck[@intFromEnum(ctm)];
+        if (ctm_attackers == 0) break;
+
+        res = !res;
+
+        var p: Piece = .NONE;
+        var p_bb: BB = 0;
+        inline for (SEE_ORDER) |lva| {
+            if (p == .NONE) {
+                const bb = ctm_attackers & b.pieces[@intFromEnum(lva.with_ctm(ctm))];
+                if (bb > 0) {
+                    p = lva;
+                    p_bb = board.square(@ctz(bb));
+                }
+            }
+        }
+
+        // the king can only take if the square isn't defended anymore
+        if (p == .KING) {
+            return if (attackers & b.col_bb(ctm.opp()) > 0) !res else res;
+        }
+
+        swap = PIECE_VALS[@intFromEnum(p)] - swap;
+        if (swap < @intFromBool(res)) break;
+
+        occ ^= p_bb;
+
+        // add any attackers that were behind the piece that just captured
+        switch (p) {
+            .PAWN, .BISHOP => attackers |= movegen.lookup_bishop(occ, to) & bishop_likes,
+            .ROOK => attackers |= movegen.lookup_rook(occ, to) & rook_likes,
+            .QUEEN => attackers |= (movegen.lookup_bishop(occ, to) & bishop_likes) |
+                (movegen.lookup_rook(occ, to) & rook_likes),
+            else => {},
+        }
+    }
+
+    return res;
+}
+
+// the order that captures are tried in before see has been checked, victim
+// value first and then the least valuable attacker
+const ATTACKER_RANK: [12]i32 = .{ 0, 0, 1, 1, 3, 3, 2, 2, 4, 4, 5, 5 };
+
 fn mvvlva(piece: Piece, xpiece: Piece) i32 {
-    return PIECE_VALS[@intFromEnum(xpiece)] - PIECE_VALS[@intFromEnum(piece)];
+    return PIECE_VALS[@intFromEnum(xpiece)] - ATTACKER_RANK[@intFromEnum(piece)];
+}
+
+// the score a capture gets once see has shown it loses material, still
+// ordered amongst the other bad captures by mvv-lva
+pub fn bad_capture_score(m: Move, b: *const Board) i32 {
+    return BAD_CAP_MOVE_SCORE + mvvlva(m.moved_piece(b), m.captured_piece(b));
 }
 
-pub fn score_move(m: Move, b: *const Board, pv_move: ?Move, tt_bestmove: ?Move) i32 {
+// piece is the moving piece, the generator already knows it so it is passed in
+// rather than looked up again
+pub fn score_move(m: Move, piece: Piece, b: *const Board, pv_move: ?Move, tt_bestmove: ?Move) i32 {
     if (pv_move) |pv| if (movegen.moves_eq(m, pv)) {
         return PV_BEST_SCORE;
     };
@@ -211,12 +435,11 @@ pub fn score_move(m: Move, b: *const Board, pv_move: ?Move, tt_bestmove: ?Move)
     if (tt_bestmove) |bm| if (movegen.moves_eq(m, bm)) return TT_BEST_SCORE;
 
     return switch (m.mt) {
-        .QUIET, .DOUBLE, .WKINGSIDE, .BKINGSIDE, .WQUEENSIDE, .BQUEENSIDE => PIECE_VALS[@intFromEnum(m.piece)],
-        .PROMO => PROMO_MOVE_SCORE + PIECE_VALS[@intFromEnum(m.xpiece)],
-        .NPROMOCAP => CAP_MOVE_SCORE + see(b, m.from, m.to, .KNIGHT, m.xpiece),
-        .RPROMOCAP => CAP_MOVE_SCORE + see(b, m.from, m.to, .ROOK, m.xpiece),
-        .BPROMOCAP => CAP_MOVE_SCORE + see(b, m.from, m.to, .BISHOP, m.xpiece),
-        .QPROMOCAP => CAP_MOVE_SCORE + see(b, m.from, m.to, .QUEEN, m.xpiece),
-        .CAP, .EP => CAP_MOVE_SCORE + see(b, m.from, m.to, m.piece, m.xpiece),
+        .QUIET, .DOUBLE, .WKINGSIDE, .BKINGSIDE, .WQUEENSIDE, .BQUEENSIDE => PIECE_VALS[@intFromEnum(piece)],
+        .NPROMO, .RPROMO, .BPROMO, .QPROMO => PROMO_MOVE_SCORE + PIECE_VALS[@intFromEnum(m.mt.promo_piece())],
+        // captures are only scored by mvv-lva here, the move list checks
+        // see_ge when one is actually picked (most never are)
+        .NPROMOCAP, .RPROMOCAP, .BPROMOCAP, .QPROMOCAP => CAP_MOVE_SCORE + mvvlva(piece, m.captured_piece(b)) + PIECE_VALS[@intFromEnum(m.mt.promo_piece())],
+        .CAP, .EP => CAP_MOVE_SCORE + mvvlva(piece, m.captured_piece(b)),
     };
 }
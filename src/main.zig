@@ -1,6 +1,8 @@
 const std = @import("std");
 const board = @import("board.zig");
 const UCI = @import("uci.zig").UCI;
+const Engine = @import("engine.zig").Engine;
+const tt = @import("tt.zig");
 const ZigTimer = @import("timer.zig").ZigTimer;
 
 pub const std_options = std.Options{ .log_level = std.log.Level.debug };
@@ -23,7 +25,10 @@ pub fn main() !void {
     var stdout = std.fs.File.stdout();
     var wbuf: [1024]u8 = undefined;
     var writer = stdout.writer(&wbuf);
-    var game = try UCI.init(allocator, &writer.interface, board.default_board());
+    const engine = try Engine.init(std.heap.page_allocator, tt.DEFAULT_TT_MB);
+    defer engine.deinit();
+
+    var game = try UCI.init(allocator, &writer.interface, engine, board.default_board());
 
     var stdin = std.fs.File.stdin();
     var rbuf: [1024]u8 = undefined;
@@ -0,0 +1,571 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const Piece = board.Piece;
+const movegen = @import("movegen.zig");
+const uci = @import("uci.zig");
+
+// plays two uci engines (eg. two builds of crig) against each other from a
+// list of openings, each opening is played twice with the colours swapped
+// run with `zig build match -- <engine 1> <engine 2> [options]`, see usage
+
+pub const std_options: std.Options = .{ .log_level = .info };
+
+const usage =
+    \\usage: match <engine 1> <engine 2> [options]
+    \\  engines are commands, eg. "zig-out/bin/crig" or "./old_crig"
+    \\  --openings <file>   one opening per line, a fen or uci moves from startpos
+    \\  --games <n>         most games to play (default 1000)
+    \\  --concurrency <n>   games played at once (default: cpu count)
+    \\  --tc <base+inc>     seconds per game plus increment (default 10+0.1)
+    \\  --elo0 <elo>        sprt null hypothesis (default 0)
+    \\  --elo1 <elo>        sprt alternative hypothesis (default 5)
+    \\  --alpha <p>         sprt false positive rate (default 0.05)
+    \\  --beta <p>          sprt false negative rate (default 0.05)
+    \\
+;
+
+// the engines' own view of the score decides a game once it is clear enough
+const RESIGN_CP = 800;
+const RESIGN_MOVES = 4;
+const DRAW_CP = 10;
+const DRAW_PLIES = 8;
+const DRAW_MIN_PLY = 80;
+const MAX_PLIES = 600;
+const MATE_CP = 30000;
+
+// how far over its clock an engine can go before losing on time
+const TIME_MARGIN_MS = 50;
+const HANDSHAKE_TIMEOUT_MS = 5000;
+
+const allocator = std.heap.smp_allocator;
+
+const Config = struct {
+    engines: [2][]const u8 = undefined,
+    openings_path: ?[]const u8 = null,
+    games: usize = 1000,
+    concurrency: usize = 0,
+    base_ms: u64 = 10000,
+    inc_ms: u64 = 100,
+    elo0: f64 = 0,
+    elo1: f64 = 5,
+    alpha: f64 = 0.05,
+    beta: f64 = 0.05,
+
+    fn parse(args: []const []const u8) !Config {
+        var config = Config{};
+        var engine_count: usize = 0;
+
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (!std.mem.startsWith(u8, arg, "--")) {
+                if (engine_count == 2) return error.TooManyEngines;
+                config.engines[engine_count] = arg;
+                engine_count += 1;
+                continue;
+            }
+
+            i += 1;
+            if (i == args.len) return error.MissingOptionValue;
+            const value = args[i];
+
+            if (std.mem.eql(u8, arg, "--openings")) {
+                config.openings_path = value;
+            } else if (std.mem.eql(u8, arg, "--games")) {
+                config.games = try std.fmt.parseInt(usize, value, 10);
+            } else if (std.mem.eql(u8, arg, "--concurrency")) {
+                config.concurrency = try std.fmt.parseInt(usize, value, 10);
+            } else if (std.mem.eql(u8, arg, "--tc")) {
+                const plus = std.mem.indexOfScalar(u8, value, '+') orelse value.len;
+                config.base_ms = @intFromFloat(try std.fmt.parseFloat(f64, value[0..plus]) * 1000);
+                config.inc_ms = if (plus < value.len) @intFromFloat(try std.fmt.parseFloat(f64, value[plus + 1 ..]) * 1000) else 0;
+            } else if (std.mem.eql(u8, arg, "--elo0")) {
+                config.elo0 = try std.fmt.parseFloat(f64, value);
+            } else if (std.mem.eql(u8, arg, "--elo1")) {
+                config.elo1 = try std.fmt.parseFloat(f64, value);
+            } else if (std.mem.eql(u8, arg, "--alpha")) {
+                config.alpha = try std.fmt.parseFloat(f64, value);
+            } else if (std.mem.eql(u8, arg, "--beta")) {
+                config.beta = try std.fmt.parseFloat(f64, value);
+            } else {
+                return error.UnknownOption;
+            }
+        }
+
+        if (engine_count != 2) return error.NeedTwoEngines;
+        if (config.concurrency == 0) config.concurrency = std.Thread.getCpuCount() catch 1;
+        return config;
+    }
+};
+
+const Opening = struct {
+    // what goes after "position", eg. "startpos" or "fen <fen>"
+    start: []const u8,
+    // uci moves from start, space separated
+    moves: []const u8,
+};
+
+fn load_openings(path: ?[]const u8) ![]Opening {
+    var openings = std.ArrayList(Opening).empty;
+
+    const p = path orelse {
+        try openings.append(allocator, .{ .start = "startpos", .moves = "" });
+        return openings.items;
+    };
+
+    const text = try std.fs.cwd().readFileAlloc(allocator, p, 1 << 30);
+    var it = std.mem.splitScalar(u8, text, '\n');
+    while (it.next()) |raw| {
+        const line = std.mem.trim(u8, raw, " \r");
+        if (line.len == 0 or line[0] == '#') continue;
+
+        // fens always have ranks split by /
+        if (std.mem.indexOfScalar(u8, line, '/') != null) {
+            const fen = if (std.mem.startsWith(u8, line, "fen ")) line["fen ".len..] else line;
+            const start = try std.fmt.allocPrint(allocator, "fen {s}", .{fen});
+            try openings.append(allocator, .{ .start = start, .moves = "" });
+        } else {
+            try openings.append(allocator, .{ .start = "startpos", .moves = line });
+        }
+    }
+
+    if (openings.items.len == 0) return error.NoOpenings;
+    return openings.items;
+}
+
+// an engine running as a child process, spoken to over its stdin and stdout
+const Player = struct {
+    cmd: []const u8,
+    child: std.process.Child,
+    write_buf: [4096]u8,
+    read_buf: [16384]u8,
+    writer: std.fs.File.Writer,
+    reader: std.fs.File.Reader,
+    // the last score the engine reported, from its own point of view
+    score: ?i32,
+
+    fn start(self: *Player, cmd: []const u8) !void {
+        var argv = std.ArrayList([]const u8).empty;
+        defer argv.deinit(allocator);
+        var it = std.mem.tokenizeScalar(u8, cmd, ' ');
+        while (it.next()) |arg| try argv.append(allocator, arg);
+
+        self.cmd = cmd;
+        self.child = std.process.Child.init(argv.items, allocator);
+        self.child.stdin_behavior = .Pipe;
+        self.child.stdout_behavior = .Pipe;
+        self.child.stderr_behavior = .Ignore;
+        try self.child.spawn();
+
+        self.writer = self.child.stdin.?.writerStreaming(&self.write_buf);
+        self.reader = self.child.stdout.?.readerStreaming(&self.read_buf);
+        self.score = null;
+
+        try self.send("uci\n", .{});
+        try self.wait_for("uciok", HANDSHAKE_TIMEOUT_MS);
+    }
+
+    fn stop(self: *Player) void {
+        self.send("quit\n", .{}) catch {};
+        _ = self.child.kill() catch {};
+    }
+
+    fn restart(self: *Player) !void {
+        self.stop();
+        try self.start(self.cmd);
+    }
+
+    fn new_game(self: *Player) !void {
+        try self.send("ucinewgame\nisready\n", .{});
+        try self.wait_for("readyok", HANDSHAKE_TIMEOUT_MS);
+    }
+
+    fn send(self: *Player, comptime fmt: []const u8, args: anytype) !void {
+        const w = &self.writer.interface;
+        try w.print(fmt, args);
+        try w.flush();
+    }
+
+    // returns the next line without the newline, or error.Timeout if the
+    // engine says nothing for timeout_ms
+    fn read_line(self: *Player, timeout_ms: u64) ![]const u8 {
+        const r = &self.reader.interface;
+        var timer = try std.time.Timer.start();
+
+        while (std.mem.indexOfScalar(u8, r.buffered(), '\n') == null) {
+            const elapsed_ms = timer.read() / std.time.ns_per_ms;
+            if (elapsed_ms >= timeout_ms) return error.Timeout;
+
+            var fds = [_]std.posix.pollfd{.{ .fd = self.child.stdout.?.handle, .events = std.posix.POLL.IN, .revents = 0 }};
+            const wait_ms: i32 = @intCast(@min(timeout_ms - elapsed_ms, std.math.maxInt(i32)));
+            if (try std.posix.poll(&fds, wait_ms) == 0) return error.Timeout;
+
+            try r.fillMore();
+        }
+
+        const line = try r.takeDelimiterInclusive('\n');
+        return std.mem.trimRight(u8, line, "\r\n");
+    }
+
+    fn wait_for(self: *Player, prefix: []const u8, timeout_ms: u64) !void {
+        while (true) {
+            const line = try self.read_line(timeout_ms);
+            if (std.mem.startsWith(u8, line, prefix)) return;
+        }
+    }
+
+    // keeps the last score from the info lines, returns the best move
+    fn read_bestmove(self: *Player, timeout_ms: u64, buf: []u8) ![]const u8 {
+        while (true) {
+            const line = try self.read_line(timeout_ms);
+            if (std.mem.startsWith(u8, line, "info")) {
+                if (parse_score(line)) |s| self.score = s;
+                continue;
+            }
+
+            if (!std.mem.startsWith(u8, line, "bestmove ")) continue;
+            var it = std.mem.tokenizeScalar(u8, line["bestmove ".len..], ' ');
+            const m = it.next() orelse return error.NoBestMove;
+            if (m.len > buf.len) return error.NoBestMove;
+            @memcpy(buf[0..m.len], m);
+            return buf[0..m.len];
+        }
+    }
+};
+
+fn parse_score(line: []const u8) ?i32 {
+    var it = std.mem.tokenizeScalar(u8, line, ' ');
+    while (it.next()) |token| {
+        if (!std.mem.eql(u8, token, "score")) continue;
+        const kind = it.next() orelse return null;
+        const value = std.fmt.parseInt(i32, it.next() orelse return null, 10) catch return null;
+
+        if (std.mem.eql(u8, kind, "cp")) return value;
+        if (std.mem.eql(u8, kind, "mate")) return if (value > 0) MATE_CP else -MATE_CP;
+        return null;
+    }
+    return null;
+}
+
+const Outcome = enum { white_win, black_win, draw };
+
+const GameResult = struct {
+    outcome: Outcome,
+    reason: []const u8,
+
+    fn win_for(c: board.Colour, reason: []const u8) GameResult {
+        return .{ .outcome = if (c == .WHITE) .white_win else .black_win, .reason = reason };
+    }
+
+    fn draw(reason: []const u8) GameResult {
+        return .{ .outcome = .draw, .reason = reason };
+    }
+};
+
+fn insufficient_material(b: *const Board) bool {
+    const heavy = b.piece_bb(.PAWN, .WHITE) | b.piece_bb(.PAWN, .BLACK) |
+        b.piece_bb(.ROOK, .WHITE) | b.piece_bb(.ROOK, .BLACK) |
+        b.piece_bb(.QUEEN, .WHITE) | b.piece_bb(.QUEEN, .BLACK);
+    if (heavy > 0) return false;
+
+    const minors = b.piece_bb(.KNIGHT, .WHITE) | b.piece_bb(.KNIGHT, .BLACK) |
+        b.piece_bb(.BISHOP, .WHITE) | b.piece_bb(.BISHOP, .BLACK);
+    return @popCount(minors) <= 1;
+}
+
+// the game is over in b, without asking the engines
+fn game_over(b: *const Board, history: []const u64) ?GameResult {
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
+    if (ml.count == 0) {
+        if (b.is_in_check()) return GameResult.win_for(b.ctm.opp(), "checkmate");
+        return GameResult.draw("stalemate");
+    }
+
+    if (b.halfmove >= 100) return GameResult.draw("fifty moves");
+    if (insufficient_material(b)) return GameResult.draw("insufficient material");
+    if (std.mem.count(u64, history, &.{b.hash}) >= 3) return GameResult.draw("threefold repetition");
+    if (history.len >= MAX_PLIES) return GameResult.draw("too long");
+    return null;
+}
+
+// players[0] is white
+fn play_game(players: [2]*Player, opening: Opening, config: *const Config) !GameResult {
+    for (players) |p| {
+        try p.new_game();
+        p.score = null;
+    }
+
+    var b = if (std.mem.startsWith(u8, opening.start, "fen ")) try board.board_from_fen(opening.start["fen ".len..]) else board.default_board();
+
+    var moves = std.ArrayList(u8).empty;
+    defer moves.deinit(allocator);
+    var history = std.ArrayList(u64).empty;
+    defer history.deinit(allocator);
+    try history.append(allocator, b.hash);
+
+    var it = std.mem.tokenizeScalar(u8, opening.moves, ' ');
+    while (it.next()) |s| {
+        b = try uci.process_moves(b, s, null);
+        try history.append(allocator, b.hash);
+        if (moves.items.len > 0) try moves.append(allocator, ' ');
+        try moves.appendSlice(allocator, s);
+    }
+
+    var clock = [2]i64{ @intCast(config.base_ms), @intCast(config.base_ms) };
+    var resign_moves = [2]usize{ 0, 0 };
+    var draw_plies: usize = 0;
+
+    while (true) {
+        if (game_over(&b, history.items)) |res| return res;
+
+        const ci = @intFromEnum(b.ctm);
+        const p = players[ci];
+
+        if (moves.items.len == 0) {
+            try p.send("position {s}\n", .{opening.start});
+        } else {
+            try p.send("position {s} moves {s}\n", .{ opening.start, moves.items });
+        }
+        try p.send("go wtime {d} btime {d} winc {d} binc {d}\n", .{ @max(clock[0], 1), @max(clock[1], 1), config.inc_ms, config.inc_ms });
+
+        var timer = try std.time.Timer.start();
+        var move_buf: [8]u8 = undefined;
+        const timeout: u64 = @intCast(clock[ci] + TIME_MARGIN_MS);
+        const move_str = p.read_bestmove(timeout, &move_buf) catch |err| switch (err) {
+            error.Timeout => return GameResult.win_for(b.ctm.opp(), "time forfeit"),
+            else => return err,
+        };
+
+        clock[ci] -= @intCast(timer.read() / std.time.ns_per_ms);
+        if (clock[ci] < -TIME_MARGIN_MS) return GameResult.win_for(b.ctm.opp(), "time forfeit");
+        clock[ci] += @intCast(config.inc_ms);
+
+        const mover = b.ctm;
+        b = uci.process_moves(b, move_str, null) catch return GameResult.win_for(mover.opp(), "illegal move");
+        try history.append(allocator, b.hash);
+        if (moves.items.len > 0) try moves.append(allocator, ' ');
+        try moves.appendSlice(allocator, move_str);
+
+        // both engines have to agree before a game is adjudicated
+        const own = p.score orelse continue;
+        const other = players[ci ^ 1].score orelse continue;
+
+        resign_moves[ci] = if (own <= -RESIGN_CP and other >= RESIGN_CP) resign_moves[ci] + 1 else 0;
+        if (resign_moves[ci] >= RESIGN_MOVES) return GameResult.win_for(mover.opp(), "adjudicated win");
+
+        draw_plies = if (@abs(own) <= DRAW_CP and @abs(other) <= DRAW_CP) draw_plies + 1 else 0;
+        if (history.items.len >= DRAW_MIN_PLY and draw_plies >= DRAW_PLIES) return GameResult.draw("adjudicated draw");
+    }
+}
+
+// results from engine 1's point of view
+const Stats = struct {
+    wins: usize = 0,
+    draws: usize = 0,
+    losses: usize = 0,
+
+    fn games(self: Stats) usize {
+        return self.wins + self.draws + self.losses;
+    }
+
+    fn score(self: Stats) f64 {
+        const n: f64 = @floatFromInt(self.games());
+        return (@as(f64, @floatFromInt(self.wins)) + @as(f64, @floatFromInt(self.draws)) / 2) / n;
+    }
+
+    // variance of a single game's score
+    fn variance(self: Stats) f64 {
+        const n: f64 = @floatFromInt(self.games());
+        const s = self.score();
+        const w = @as(f64, @floatFromInt(self.wins)) / n;
+        const d = @as(f64, @floatFromInt(self.draws)) / n;
+        const l = @as(f64, @floatFromInt(self.losses)) / n;
+        return w * (1 - s) * (1 - s) + d * (0.5 - s) * (0.5 - s) + l * s * s;
+    }
+
+    // elo and the 95% error either side of it
+    fn elo(self: Stats) struct { f64, f64 } {
+        const s = self.score();
+        const n: f64 = @floatFromInt(self.games());
+        const margin = 1.959964 * @sqrt(self.variance() / n);
+        const lo = elo_from_score(s - margin);
+        const hi = elo_from_score(s + margin);
+        return .{ elo_from_score(s), (hi - lo) / 2 };
+    }
+
+    // likelihood of superiority
+    fn los(self: Stats) f64 {
+        const wl: f64 = @floatFromInt(self.wins + self.losses);
+        if (wl == 0) return 0.5;
+        const diff = @as(f64, @floatFromInt(self.wins)) - @as(f64, @floatFromInt(self.losses));
+        return 0.5 * (1 + erf(diff / @sqrt(2 * wl)));
+    }
+
+    // log likelihood ratio of elo1 against elo0, using the normal
+    // approximation to the trinomial
+    fn llr(self: Stats, elo0: f64, elo1: f64) f64 {
+        const v = self.variance();
+        if (v == 0) return 0;
+        const n: f64 = @floatFromInt(self.games());
+        const s0 = score_from_elo(elo0);
+        const s1 = score_from_elo(elo1);
+        return n * (s1 - s0) * (2 * self.score() - s0 - s1) / (2 * v);
+    }
+};
+
+fn elo_from_score(s: f64) f64 {
+    const clamped = std.math.clamp(s, 1e-6, 1 - 1e-6);
+    return -400 * std.math.log10(1 / clamped - 1);
+}
+
+fn score_from_elo(e: f64) f64 {
+    return 1 / (1 + std.math.pow(f64, 10, -e / 400));
+}
+
+// Abramowitz and Stegun 7.1.26, plenty for a percentage
+fn erf(x: f64) f64 {
+    const t = 1 / (1 + 0.3275911 * @abs(x));
+    const y = 1 - (((((1.061405429 * t - 1.453152027) * t) + 1.421413741) * t - 0.284496736) * t + 0.254829592) * t * @exp(-x * x);
+    return if (x >= 0) y else -y;
+}
+
+const Match = struct {
+    config: Config,
+    openings: []const Opening,
+    // game pairs handed out so far
+    next_pair: std.atomic.Value(usize),
+    done: std.atomic.Value(bool),
+    mutex: std.Thread.Mutex,
+    stats: Stats,
+    llr_bounds: [2]f64,
+
+    fn pairs(self: *const Match) usize {
+        return (self.config.games + 1) / 2;
+    }
+
+    fn record(self: *Match, engine1_white: bool, res: GameResult) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        const engine1_won = (res.outcome == .white_win) == engine1_white;
+        switch (res.outcome) {
+            .draw => self.stats.draws += 1,
+            else => if (engine1_won) {
+                self.stats.wins += 1;
+            } else {
+                self.stats.losses += 1;
+            },
+        }
+
+        const s = self.stats;
+        const elo, const err = s.elo();
+        const llr = s.llr(self.config.elo0, self.config.elo1);
+        std.debug.print("game {d} ({s}): +{d} ={d} -{d}  elo {d:.1} +/- {d:.1}  los {d:.1}%  llr {d:.2} ({d:.2}, {d:.2})\n", .{
+            s.games(),
+            res.reason,
+            s.wins,
+            s.draws,
+            s.losses,
+            elo,
+            err,
+            s.los() * 100,
+            llr,
+            self.llr_bounds[0],
+            self.llr_bounds[1],
+        });
+
+        if (llr <= self.llr_bounds[0] or llr >= self.llr_bounds[1] or s.games() >= self.config.games) {
+            self.done.store(true, .monotonic);
+        }
+    }
+
+    fn worker(self: *Match) void {
+        self.play_pairs() catch |err| {
+            std.log.err("match worker stopped: {s}", .{@errorName(err)});
+        };
+    }
+
+    fn play_pairs(self: *Match) !void {
+        const players = try allocator.alloc(Player, 2);
+        defer allocator.free(players);
+
+        try players[0].start(self.config.engines[0]);
+        defer players[0].stop();
+        try players[1].start(self.config.engines[1]);
+        defer players[1].stop();
+
+        while (!self.done.load(.monotonic)) {
+            const pair = self.next_pair.fetchAdd(1, .monotonic);
+            if (pair >= self.pairs()) return;
+            const opening = self.openings[pair % self.openings.len];
+
+            // the same opening from both sides
+            for ([_]bool{ true, false }) |engine1_white| {
+                if (self.done.load(.monotonic)) return;
+                const white = &players[if (engine1_white) 0 else 1];
+                const black = &players[if (engine1_white) 1 else 0];
+
+                const res = play_game(.{ white, black }, opening, &self.config) catch |err| {
+                    // the engine probably crashed, it starts again next game
+                    std.log.warn("game abandoned: {s}", .{@errorName(err)});
+                    for (players) |*p| try p.restart();
+                    continue;
+                };
+                self.record(engine1_white, res);
+            }
+        }
+    }
+};
+
+pub fn main() !void {
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    const config = Config.parse(args[1..]) catch |err| {
+        std.debug.print("{s}\n{s}", .{ @errorName(err), usage });
+        return err;
+    };
+
+    const m = try allocator.create(Match);
+    defer allocator.destroy(m);
+    m.* = .{
+        .config = config,
+        .openings = try load_openings(config.openings_path),
+        .next_pair = std.atomic.Value(usize).init(0),
+        .done = std.atomic.Value(bool).init(false),
+        .mutex = .{},
+        .stats = .{},
+        .llr_bounds = .{ @log(config.beta / (1 - config.alpha)), @log((1 - config.beta) / config.alpha) },
+    };
+
+    std.debug.print("{s} vs {s}, {d} openings, {d} games at once\n", .{ config.engines[0], config.engines[1], m.openings.len, config.concurrency });
+
+    const threads = try allocator.alloc(std.Thread, config.concurrency);
+    defer allocator.free(threads);
+    for (threads) |*t| t.* = try std.Thread.spawn(.{}, Match.worker, .{m});
+    for (threads) |t| t.join();
+
+    const s = m.stats;
+    if (s.games() == 0) return error.NoGamesPlayed;
+
+    const elo, const err = s.elo();
+    const llr = s.llr(config.elo0, config.elo1);
+    const verdict = if (llr >= m.llr_bounds[1]) "H1 accepted" else if (llr <= m.llr_bounds[0]) "H0 accepted" else "inconclusive";
+    std.debug.print("\n{s} vs {s}: +{d} ={d} -{d} in {d} games\nelo {d:.1} +/- {d:.1}, los {d:.1}%, sprt [{d}, {d}]: {s}\n", .{
+        config.engines[0],
+        config.engines[1],
+        s.wins,
+        s.draws,
+        s.losses,
+        s.games(),
+        elo,
+        err,
+        s.los() * 100,
+        config.elo0,
+        config.elo1,
+        verdict,
+    });
+}
@@ -0,0 +1,252 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const movegen = @import("movegen.zig");
+const Move = movegen.Move;
+const search = @import("search.zig");
+const PV = @import("tt.zig").PV;
+const Timer = @import("timer.zig").Timer;
+
+// proves forced mates for `go mate N` with proof-number search, separately
+// from the alpha-beta search. the side to move is the attacker and only ever
+// gives check, the defender tries every legal reply. the tree lives in an
+// arena that is thrown away once the search is done
+// see https://www.chessprogramming.org/Proof-Number_Search
+
+pub const MAX_MATE_MOVES = 64;
+
+// the tree is kept in memory, so the search is cut off at this many nodes
+// unless go gives its own node limit
+const DEFAULT_MAX_NODES = 1 << 22;
+
+const INF: u32 = std.math.maxInt(u32);
+const TIME_CHECK_INTERVAL = 1024;
+
+// the attacker moves at even plies (or nodes), the defender at odd plies
+// (and nodes), so a node's kind comes from how deep it is
+const Node = struct {
+    // how many more leaves have to be proven to prove this node, and
+    // disproven to disprove it. 0 is solved, INF can't be
+    proof: u32,
+    disproof: u32,
+    move: Move,
+    parent: ?*Node,
+    children: []Node,
+    expanded: bool,
+
+    fn is_proven(self: *const Node) bool {
+        return self.proof == 0;
+    }
+
+    fn set_proven(self: *Node) void {
+        self.proof = 0;
+        self.disproof = INF;
+    }
+
+    fn set_disproven(self: *Node) void {
+        self.proof = INF;
+        self.disproof = 0;
+    }
+};
+
+pub const MateResult = struct {
+    // in moves, null if no mate was proven
+    mate_in: ?usize,
+    // the mating line, the defender playing the longest defence
+    pv: PV,
+    nodes: usize,
+};
+
+const MateSearch = struct {
+    arena: std.mem.Allocator,
+    max_moves: usize,
+    nodes: usize,
+
+    // the child reached by m, b is the position after m and ply is the child's
+    fn new_child(self: *const MateSearch, b: *const Board, m: Move, parent: *Node, ply: usize) Node {
+        var n = Node{ .proof = 1, .disproof = 1, .move = m, .parent = parent, .children = &.{}, .expanded = false };
+        if (ply % 2 == 0) return n;
+
+        // the defender to move, after a check
+        var ml = movegen.MoveList.new(b, null, null);
+        movegen.gen_moves(&ml);
+        if (ml.count == 0) {
+            // the attacker only gives check, but stalemate is handled anyway
+            if (b.is_in_check()) n.set_proven() else n.set_disproven();
+        } else if ((ply + 1) / 2 >= self.max_moves) {
+            // that was the attacker's last move
+            n.set_disproven();
+        } else {
+            // every reply has to be refuted, so more replies are harder
+            n.proof = @intCast(ml.count);
+        }
+
+        return n;
+    }
+
+    fn expand(self: *MateSearch, n: *Node, b: *const Board, ply: usize) !void {
+        var ml = movegen.MoveList.new(b, null, null);
+        movegen.gen_moves(&ml);
+
+        var children: [256]Node = undefined;
+        var count: usize = 0;
+        var next: Board = undefined;
+        while (ml.next()) |m| {
+            b.copy_make(&next, m);
+            if (ply % 2 == 0 and !next.is_in_check()) continue;
+
+            children[count] = self.new_child(&next, m, n, ply + 1);
+            count += 1;
+        }
+
+        n.children = try self.arena.dupe(Node, children[0..count]);
+        n.expanded = true;
+        self.nodes += count;
+    }
+};
+
+// an attacker node is proven by any child and disproven by all of them, the
+// other way round for the defender. an attacker with no checks is disproven
+fn set_numbers(n: *Node, ply: usize) void {
+    var min: u32 = INF;
+    var sum: u32 = 0;
+    for (n.children) |*c| {
+        if (ply % 2 == 0) {
+            min = @min(min, c.proof);
+            sum +|= c.disproof;
+        } else {
+            min = @min(min, c.disproof);
+            sum +|= c.proof;
+        }
+    }
+
+    if (ply % 2 == 0) {
+        n.proof = min;
+        n.disproof = sum;
+    } else {
+        n.proof = sum;
+        n.disproof = min;
+    }
+}
+
+// updates the numbers from n back up to the root, stopping once they
+// don't change
+fn backup(leaf: *Node, leaf_ply: usize) void {
+    var n = leaf;
+    var ply = leaf_ply;
+    while (true) {
+        const proof = n.proof;
+        const disproof = n.disproof;
+        set_numbers(n, ply);
+        if (n != leaf and n.proof == proof and n.disproof == disproof) return;
+
+        n = n.parent orelse return;
+        ply -= 1;
+    }
+}
+
+// the child that most needs (dis)proving: the easiest to prove for the
+// attacker, the easiest to disprove for the defender
+fn most_proving_child(n: *Node, ply: usize) *Node {
+    var best = &n.children[0];
+    for (n.children[1..]) |*c| {
+        if (ply % 2 == 0) {
+            if (c.proof < best.proof) best = c;
+        } else {
+            if (c.disproof < best.disproof) best = c;
+        }
+    }
+    return best;
+}
+
+// plies to mate from a proven node, the attacker taking the quickest mate
+// it has found and the defender the slowest. proven leaves are checkmates
+fn mate_plies(n: *const Node, ply: usize) usize {
+    if (!n.expanded) return 0;
+
+    var best: ?usize = null;
+    for (n.children) |*c| {
+        if (!c.is_proven()) continue;
+        const plies = mate_plies(c, ply + 1) + 1;
+        best = if (best) |b| (if (ply % 2 == 0) @min(b, plies) else @max(b, plies)) else plies;
+    }
+    return best.?;
+}
+
+fn mate_pv(root: *const Node, pv: *PV) void {
+    var n = root;
+    var ply: usize = 0;
+    while (n.expanded) : (ply += 1) {
+        var best: ?*const Node = null;
+        var best_plies: usize = 0;
+        for (n.children) |*c| {
+            if (!c.is_proven()) continue;
+            const plies = mate_plies(c, ply + 1);
+            const better = if (ply % 2 == 0) plies < best_plies else plies > best_plies;
+            if (best == null or better) {
+                best = c;
+                best_plies = plies;
+            }
+        }
+
+        n = best.?;
+        pv.moves[pv.len] = n.move;
+        pv.len += 1;
+    }
+}
+
+// looks for a mate in at most max_moves moves for the side to move in b,
+// giving up at the limits' node count or movetime or once stop is set
+pub fn find_mate(
+    allocator: std.mem.Allocator,
+    b: *const Board,
+    max_moves: usize,
+    limits: *const search.Limits,
+    stop: *const std.atomic.Value(bool),
+) !MateResult {
+    var arena_state = std.heap.ArenaAllocator.init(allocator);
+    defer arena_state.deinit();
+
+    var ms = MateSearch{
+        .arena = arena_state.allocator(),
+        .max_moves = @min(max_moves, MAX_MATE_MOVES),
+        .nodes = 1,
+    };
+    const max_nodes = limits.nodes orelse DEFAULT_MAX_NODES;
+
+    var timer = try Timer().init();
+    var res = MateResult{ .mate_in = null, .pv = PV.init(), .nodes = 0 };
+    if (ms.max_moves == 0) return res;
+
+    var root = Node{ .proof = 1, .disproof = 1, .move = Move.NONE, .parent = null, .children = &.{}, .expanded = false };
+    // the boards along the current path, the tree only stores moves
+    var boards: [2 * MAX_MATE_MOVES]Board = undefined;
+    boards[0] = b.*;
+
+    var iters: usize = 0;
+    while (!root.is_proven() and root.disproof != 0) : (iters += 1) {
+        if (ms.nodes >= max_nodes) break;
+        if (iters % TIME_CHECK_INTERVAL == 0) {
+            if (stop.load(.monotonic)) break;
+            if (try timer.elapsed_ns() / std.time.ns_per_ms > limits.movetime_ms) break;
+        }
+
+        var n = &root;
+        var ply: usize = 0;
+        while (n.expanded) : (ply += 1) {
+            n = most_proving_child(n, ply);
+            boards[ply].copy_make(&boards[ply + 1], n.move);
+        }
+
+        try ms.expand(n, &boards[ply], ply);
+        backup(n, ply);
+    }
+
+    res.nodes = ms.nodes;
+    if (root.is_proven()) {
+        res.mate_in = (mate_plies(&root, 0) + 1) / 2;
+        mate_pv(&root, &res.pv);
+    }
+    return res;
+}
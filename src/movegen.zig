@@ -1,5 +1,7 @@
 const std = @import("std");
+const builtin = @import("builtin");
 const log = std.log;
+const config = @import("config");
 
 const board = @import("board.zig");
 const Board = board.Board;
@@ -21,18 +23,21 @@ pub const rook_magics = consts.rook_magics;
 const rook_move_table = consts.rook_move_table;
 pub const bishop_magics = consts.bishop_magics;
 const bishop_move_table = consts.bishop_move_table;
+const rook_pext = consts.rook_pext;
+const rook_pext_table = consts.rook_pext_table;
+const bishop_pext = consts.bishop_pext;
+const bishop_pext_table = consts.bishop_pext_table;
 
-const tt = @import("tt.zig");
 const search = @import("search.zig");
 const eval = @import("eval.zig");
 
 const NO_SQUARES = 0;
 const ALL_SQUARES = 0xFFFFFFFFFFFFFFFF;
 
+const PROMO_MTS = [4]MoveType{ MoveType.NPROMO, MoveType.RPROMO, MoveType.BPROMO, MoveType.QPROMO };
 const PROMO_CAP_MTS = [4]MoveType{ MoveType.NPROMOCAP, MoveType.RPROMOCAP, MoveType.BPROMOCAP, MoveType.QPROMOCAP };
-const PROMO_PIECES_W = [4]Piece{ Piece.KNIGHT, Piece.ROOK, Piece.BISHOP, Piece.QUEEN };
-const PROMO_PIECES_B = [4]Piece{ Piece.KNIGHT_B, Piece.ROOK_B, Piece.BISHOP_B, Piece.QUEEN_B };
 
+// exactly 16 move types, so that a move fits in 16 bits
 pub const MoveType = enum(u4) {
     QUIET,
     DOUBLE,
@@ -41,7 +46,10 @@ pub const MoveType = enum(u4) {
     BKINGSIDE,
     WQUEENSIDE,
     BQUEENSIDE,
-    PROMO,
+    NPROMO,
+    RPROMO,
+    BPROMO,
+    QPROMO,
     NPROMOCAP,
     RPROMOCAP,
     BPROMOCAP,
@@ -50,28 +58,40 @@ pub const MoveType = enum(u4) {
 
     pub fn is_promo(self: MoveType) bool {
         return switch (self) {
-            MoveType.PROMO, MoveType.NPROMOCAP, MoveType.BPROMOCAP, MoveType.RPROMOCAP, MoveType.QPROMOCAP => true,
+            .NPROMO, .RPROMO, .BPROMO, .QPROMO, .NPROMOCAP, .RPROMOCAP, .BPROMOCAP, .QPROMOCAP => true,
             else => false,
         };
     }
 
     pub fn is_cap(self: MoveType) bool {
         return switch (self) {
-            MoveType.CAP, MoveType.NPROMOCAP, MoveType.RPROMOCAP, MoveType.BPROMOCAP, MoveType.QPROMOCAP, MoveType.EP => true,
+            .CAP, .NPROMOCAP, .RPROMOCAP, .BPROMOCAP, .QPROMOCAP, .EP => true,
             else => false,
         };
     }
+
+    // the white version of the promoted piece, NONE if not a promotion
+    pub fn promo_piece(self: MoveType) Piece {
+        return switch (self) {
+            .NPROMO, .NPROMOCAP => .KNIGHT,
+            .RPROMO, .RPROMOCAP => .ROOK,
+            .BPROMO, .BPROMOCAP => .BISHOP,
+            .QPROMO, .QPROMOCAP => .QUEEN,
+            else => .NONE,
+        };
+    }
 };
 
-// this arrangement seems to be the most performant
-// even if it is 28bytes - with padding to make it a u32 seems to be slower
-pub const Move = packed struct {
-    from: u8,
-    to: u8,
-    piece: Piece,
-    xpiece: Piece,
+// only from, to and the move type are stored, the moving and captured pieces
+// are looked up on the board (before the move is made) when they are needed
+pub const Move = packed struct(u16) {
+    from: u6,
+    to: u6,
     mt: MoveType,
 
+    // a1a1 can never be a real move
+    pub const NONE: Move = @bitCast(@as(u16, 0));
+
     pub fn log(self: Move, comptime log_fn: fn (comptime []const u8, anytype) void) void {
         var buf: [256]u8 = undefined;
         var w = std.Io.Writer.fixed(&buf);
@@ -87,19 +107,33 @@ pub const Move = packed struct {
         try util.move_as_uci_str(self, w);
     }
 
-    pub fn new(from: usize, to: usize, piece: Piece, xpiece: Piece, mt: MoveType) Move {
-        return Move{ .from = @intCast(from), .to = @intCast(to), .piece = piece, .xpiece = xpiece, .mt = mt };
+    pub fn new(from: usize, to: usize, mt: MoveType) Move {
+        return Move{ .from = @intCast(from), .to = @intCast(to), .mt = mt };
+    }
+
+    // b is the board the move is about to be made on
+    pub inline fn moved_piece(self: Move, b: *const Board) Piece {
+        return b.get_piece_not_none(self.from, b.ctm);
+    }
+
+    // b is the board the move is about to be made on
+    pub inline fn captured_piece(self: Move, b: *const Board) Piece {
+        if (self.mt == .EP) return Piece.PAWN.with_ctm(b.ctm.opp());
+        if (!self.mt.is_cap()) return .NONE;
+        return b.get_piece_not_none(self.to, b.ctm.opp());
     }
 };
 
-pub fn moves_eq(m1: Move, m2: Move) bool {
-    return @as(u28, @bitCast(m1)) == @as(u28, @bitCast(m2));
+pub inline fn moves_eq(m1: Move, m2: Move) bool {
+    return @as(u16, @bitCast(m1)) == @as(u16, @bitCast(m2));
 }
 
 const UciMoveParseError = error{ InvalidUciStrLen, InvalidUciStrFromPiece, IllegalMove };
 
 pub const UciMoveParseErrorInfo = struct { err: UciMoveParseError, move: []const u8 };
 
+// only the legal moves of the moving piece's type are generated rather than
+// every legal move, that's all it takes to check the move
 pub fn parse_uci_move_legal(b: Board, move: []const u8) !Move {
     const m = try new_move_from_uci(move, &b);
 
@@ -107,10 +141,15 @@ pub fn parse_uci_move_legal(b: Board, move: []const u8) !Move {
     m.log(std.log.debug);
     std.log.debug("", .{});
 
-    var ml = MoveList.new(&b, null);
-    gen_moves(&ml, b.is_in_check());
+    if (b.col_bb(b.ctm) & square(m.from) == 0) return error.InvalidUciStrFromPiece;
 
-    while (ml.next()) |legal_move| {
+    var ml = MoveList.new(&b, null, null);
+    gen_piece_moves(&ml, b.get_piece(m.from));
+
+    // the entries are scanned as they are, picking them in order with next
+    // would pay for see on every capture
+    for (ml.entries[0..ml.count]) |e| {
+        const legal_move = unpack_move(e);
         legal_move.log(std.log.debug);
 
         if (moves_eq(legal_move, m)) return m;
@@ -130,7 +169,7 @@ pub fn new_move_from_uci(uci: []const u8, b: *const Board) !Move {
 
     var promo = Piece.NONE;
     if (uci.len == 5) {
-        promo = util.promo_from_char(uci[4], b.ctm) orelse Piece.NONE;
+        promo = util.promo_from_char(uci[4], .WHITE) orelse Piece.NONE;
     }
 
     const piece = b.get_piece(from);
@@ -138,116 +177,147 @@ pub fn new_move_from_uci(uci: []const u8, b: *const Board) !Move {
         return error.InvalidUciStrFromPiece;
     }
 
-    var mt = MoveType.QUIET;
+    const is_cap = b.get_piece(to) != Piece.NONE;
 
     // check for double push
     const diff = if (from < to) to - from else from - to;
-    if (@intFromEnum(piece) < @intFromEnum(Piece.KNIGHT) and diff == 16) {
-        mt = MoveType.DOUBLE;
+    if (piece.is_pawn() and diff == 16) {
+        return Move.new(from, to, .DOUBLE);
     }
 
     if (@intFromEnum(piece) >= @intFromEnum(Piece.KING) and diff == 2) {
-        mt = switch (b.ctm) {
-            .WHITE => if (from < to) MoveType.WKINGSIDE else MoveType.WQUEENSIDE,
-            .BLACK => if (from < to) MoveType.BKINGSIDE else MoveType.BQUEENSIDE,
+        const mt: MoveType = switch (b.ctm) {
+            .WHITE => if (from < to) .WKINGSIDE else .WQUEENSIDE,
+            .BLACK => if (from < to) .BKINGSIDE else .BQUEENSIDE,
         };
+        return Move.new(from, to, mt);
     }
 
-    var xpiece = b.get_piece(to);
-    if (xpiece != Piece.NONE and promo != Piece.NONE) {
-        switch (promo) {
-            Piece.KNIGHT, Piece.KNIGHT_B => mt = MoveType.NPROMOCAP,
-            Piece.ROOK, Piece.ROOK_B => mt = MoveType.RPROMOCAP,
-            Piece.BISHOP, Piece.BISHOP_B => mt = MoveType.BPROMOCAP,
-            Piece.QUEEN, Piece.QUEEN_B => mt = MoveType.QPROMOCAP,
-            else => {},
-        }
+    if (promo != Piece.NONE) {
+        const mt: MoveType = switch (promo) {
+            .KNIGHT => if (is_cap) .NPROMOCAP else .NPROMO,
+            .ROOK => if (is_cap) .RPROMOCAP else .RPROMO,
+            .BISHOP => if (is_cap) .BPROMOCAP else .BPROMO,
+            else => if (is_cap) .QPROMOCAP else .QPROMO,
+        };
+        return Move.new(from, to, mt);
     }
 
-    if (xpiece == Piece.NONE and promo != Piece.NONE) {
-        mt = MoveType.PROMO;
-        xpiece = promo;
+    if (piece.is_pawn() and to == b.ep) {
+        return Move.new(from, to, .EP);
     }
 
-    if (@intFromEnum(piece) < @intFromEnum(Piece.KNIGHT) and to == b.ep) {
-        mt = MoveType.EP;
-    }
+    return Move.new(from, to, if (is_cap) .CAP else .QUIET);
+}
 
-    if (xpiece != Piece.NONE and promo == Piece.NONE) {
-        mt = MoveType.CAP;
+// each entry packs the score into the top 32 bits and the move into the
+// bottom 16, so that the best move is just the largest entry and scanning the
+// list is a plain integer max over a contiguous array
+const ScoredMove = i64;
+const USED_ENTRY: ScoredMove = std.math.minInt(ScoredMove);
+// set on captures whose see hasn't been checked yet, it sits below the score
+// so it never changes the order of entries
+const SEE_PENDING: ScoredMove = 1 << 16;
+
+inline fn pack_scored_move(m: Move, score: i32) ScoredMove {
+    return (@as(ScoredMove, score) << 32) | @as(ScoredMove, @as(u16, @bitCast(m)));
+}
+
+inline fn unpack_move(e: ScoredMove) Move {
+    return @bitCast(@as(u16, @truncate(@as(u64, @bitCast(e)))));
+}
+
+inline fn unpack_score(e: ScoredMove) i32 {
+    return @intCast(e >> 32);
+}
+
+const SCAN_VEC_LEN = 8;
+const ScanVec = @Vector(SCAN_VEC_LEN, ScoredMove);
+
+fn max_entry(entries: []const ScoredMove) ScoredMove {
+    var best_vec: ScanVec = @splat(USED_ENTRY);
+    var i: usize = 0;
+    while (i + SCAN_VEC_LEN <= entries.len) : (i += SCAN_VEC_LEN) {
+        const v: ScanVec = entries[i..][0..SCAN_VEC_LEN].*;
+        best_vec = @max(best_vec, v);
     }
 
-    return Move.new(from, to, piece, xpiece, mt);
+    var best = @reduce(.Max, best_vec);
+    while (i < entries.len) : (i += 1) best = @max(best, entries[i]);
+    return best;
 }
 
 pub const MoveList = struct {
     const LIST_SIZE = 256;
-    moves: [LIST_SIZE]Move,
-    scores: [LIST_SIZE]i32,
+    entries: [LIST_SIZE]ScoredMove,
     idx: usize,
     count: usize,
     board: *const Board,
     pv_move: ?Move,
     tt_bestmove: ?Move,
+    // set when the eval has already built the node's attack maps, the
+    // generator and see use them instead of working the attacks out again
+    maps: ?*const AttackMaps,
 
-    // TODO take tt.get_best_move out of here? ( tho maybe cached from call in search()? )
-    pub fn new(b: *const Board, pv_move: ?Move) MoveList {
+    pub fn new(b: *const Board, pv_move: ?Move, tt_bestmove: ?Move) MoveList {
         return MoveList{
-            .moves = undefined,
-            .scores = undefined,
+            .entries = undefined,
             .idx = 0,
             .count = 0,
             .board = b,
             .pv_move = pv_move,
-            .tt_bestmove = tt.get_best_move(b.hash),
+            .tt_bestmove = tt_bestmove,
+            .maps = null,
         };
     }
 
-    fn append(self: *MoveList, m: Move) void {
-        self.scores[self.count] = eval.score_move(m, self.board, self.pv_move, self.tt_bestmove);
-        self.moves[self.count] = m;
+    fn append(self: *MoveList, m: Move, piece: Piece) void {
+        const score = eval.score_move(m, piece, self.board, self.pv_move, self.tt_bestmove);
+        var e = pack_scored_move(m, score);
+        // the pv and tt moves are always tried first, whatever they lose
+        if (m.mt.is_cap() and score < eval.TT_BEST_SCORE) e |= SEE_PENDING;
+
+        self.entries[self.count] = e;
         self.count += 1;
     }
 
+    // removes and returns the highest scored entry, captures only have their
+    // see checked once they reach the front of the list, if they lose
+    // material they are pushed back amongst the bad captures instead
+    fn take_best(self: *MoveList) ?ScoredMove {
+        const entries = self.entries[0..self.count];
+        while (true) {
+            const best = max_entry(entries);
+            if (best == USED_ENTRY) return null;
+
+            // each move is unique so this finds exactly the best entry
+            const idx = std.mem.indexOfScalar(ScoredMove, entries, best).?;
+
+            if (best & SEE_PENDING > 0) {
+                const m = unpack_move(best);
+                if (!eval.see_ge(self.board, m, 0, self.maps)) {
+                    entries[idx] = pack_scored_move(m, eval.bad_capture_score(m, self.board));
+                    continue;
+                }
+            }
+
+            entries[idx] = USED_ENTRY;
+            return best & ~SEE_PENDING;
+        }
+    }
+
     // TODO move gen_moves and add state to MoveList, so that it
     // generates attacks, depletes the list and then gens the quiets
     // also could play with trying the TT bestmove for the position
     // before generating anything
     pub fn next(self: *MoveList) ?Move {
-        var m: ?Move = null;
-        var idx: usize = 0;
-        var best_score: i32 = std.math.minInt(i32);
-
-        for (0..self.count) |i| {
-            if (self.scores[i] > best_score) {
-                m = self.moves[i];
-                idx = i;
-                best_score = self.scores[i];
-            }
-        }
-
-        if (m == null) return null;
-        self.scores[idx] = std.math.minInt(i32);
-        return m;
+        const e = self.take_best() orelse return null;
+        return unpack_move(e);
     }
 
     pub fn next_scored(self: *MoveList) ?struct { move: Move, score: i32 } {
-        var m: ?Move = null;
-        var idx: usize = 0;
-        var best_score: i32 = std.math.minInt(i32);
-
-        for (0..self.count) |i| {
-            if (self.scores[i] > best_score) {
-                m = self.moves[i];
-                idx = i;
-                best_score = self.scores[i];
-            }
-        }
-
-        if (m == null) return null;
-
-        self.scores[idx] = std.math.minInt(i32);
-        return .{ .move = m.?, .score = best_score };
+        const e = self.take_best() orelse return null;
+        return .{ .move = unpack_move(e), .score = unpack_score(e) };
     }
 
     // TODO needed?
@@ -256,86 +326,286 @@ pub const MoveList = struct {
         self.count = 0;
     }
 
-    fn add_pawn_moves_quiet(self: *MoveList, pawns: BB, comptime piece: Piece, comptime to_offset: comptime_int, promo: Piece, comptime mt: MoveType) void {
+    fn add_pawn_moves(self: *MoveList, pawns: BB, comptime piece: Piece, comptime to_offset: comptime_int, comptime mt: MoveType) void {
         var p = pawns;
         while (p > 0) : (p &= p - 1) {
             const from: usize = @ctz(p);
             const to: usize = @intCast(@as(isize, @intCast(from)) + @as(isize, to_offset));
-            self.append(Move.new(from, to, piece, promo, mt));
+            self.append(Move.new(from, to, mt), piece);
         }
     }
 
-    fn add_pawn_moves_cap(self: *MoveList, pawns: BB, comptime piece: Piece, comptime to_offset: comptime_int, comptime opp: Colour, comptime mt: MoveType) void {
-        var p = pawns;
-        while (p > 0) : (p &= p - 1) {
-            const from: usize = @ctz(p);
-            const to: usize = @intCast(@as(isize, @intCast(from)) + @as(isize, to_offset));
-            // const xpiece = self.board.get_piece(to);
-            const xpiece = self.board.get_piece_not_none(to, opp);
-            self.append(Move.new(from, to, piece, xpiece, mt));
+    fn add_moves(self: *MoveList, from: usize, tos: BB, piece: Piece, mt: MoveType) void {
+        var t = tos;
+        while (t > 0) : (t &= t - 1) {
+            const to: usize = @ctz(t);
+            self.append(Move.new(from, to, mt), piece);
         }
     }
 
-    fn add_quiets(self: *MoveList, from: usize, quiets: BB, piece: Piece, mt: MoveType) void {
-        var q = quiets;
-        while (q > 0) : (q &= q - 1) {
-            const to: usize = @ctz(q);
-            self.append(Move.new(from, to, piece, Piece.NONE, mt));
-        }
+    // TODO needed?
+    fn sort(self: *MoveList) void {
+        _ = self;
     }
+};
 
-    fn add_caps(self: *MoveList, from: usize, caps: BB, piece: Piece, opp: Colour, mt: MoveType) void {
-        var c = caps;
-        while (c > 0) : (c &= c - 1) {
-            const to: usize = @ctz(c);
-            // self.append(Move.new(from, to, piece, self.board.get_piece(to), mt));
-            self.append(Move.new(from, to, piece, self.board.get_piece_not_none(to, opp), mt));
+// everything needed to only generate legal moves, worked out once per node
+const LegalInfo = struct {
+    king_sq: usize,
+    checkers: BB,
+    // the squares a piece other than the king can move to, every square when
+    // not in check, otherwise capturing the checker or blocking its ray
+    check_mask: BB,
+    pinned: BB,
+    // squares the opponent attacks with our king taken off the board, so the
+    // king can't step backwards along a checking slider's ray
+    danger: BB,
+
+    fn new(comptime ctm: Colour, b: *const Board, maps: ?*const AttackMaps) LegalInfo {
+        const king_sq: usize = @ctz(b.piece_bb(Piece.KING, ctm));
+        const checkers = b.attackers_of_sq(king_sq, ctm.opp());
+
+        var check_mask: BB = ALL_SQUARES;
+        if (checkers > 0) {
+            // in double check only the king can move
+            check_mask = if (checkers & (checkers - 1) > 0) NO_SQUARES else checkers | between(king_sq, @ctz(checkers));
         }
+
+        return LegalInfo{
+            .king_sq = king_sq,
+            .checkers = checkers,
+            .check_mask = check_mask,
+            .pinned = pinned_pieces(ctm, b, king_sq),
+            .danger = if (maps) |m| m.colour(ctm.opp()) else attacked_sqs(ctm.opp(), b, b.all_bb() ^ square(king_sq)),
+        };
     }
 
-    // TODO needed?
-    fn sort(self: *MoveList) void {
-        _ = self;
+    inline fn is_double_check(self: *const LegalInfo) bool {
+        return self.checkers & (self.checkers -% 1) > 0;
+    }
+
+    // a pinned piece can only move along the line through its king and pinner
+    inline fn pin_mask(self: *const LegalInfo, from: usize) BB {
+        if (square(from) & self.pinned == 0) return ALL_SQUARES;
+        return line(self.king_sq, from);
+    }
+};
+
+// the squares strictly between a and b, if they share a rank, file or diagonal
+pub fn between(a: usize, b: usize) BB {
+    const ends = square(a) | square(b);
+    if (lookup_rook(NO_SQUARES, a) & square(b) > 0) {
+        return lookup_rook(ends, a) & lookup_rook(ends, b);
+    }
+
+    if (lookup_bishop(NO_SQUARES, a) & square(b) > 0) {
+        return lookup_bishop(ends, a) & lookup_bishop(ends, b);
+    }
+
+    return NO_SQUARES;
+}
+
+// the whole rank, file or diagonal that both a and b are on
+pub fn line(a: usize, b: usize) BB {
+    const ends = square(a) | square(b);
+    if (lookup_rook(NO_SQUARES, a) & square(b) > 0) {
+        return (lookup_rook(NO_SQUARES, a) & lookup_rook(NO_SQUARES, b)) | ends;
+    }
+
+    if (lookup_bishop(NO_SQUARES, a) & square(b) > 0) {
+        return (lookup_bishop(NO_SQUARES, a) & lookup_bishop(NO_SQUARES, b)) | ends;
+    }
+
+    return NO_SQUARES;
+}
+
+fn pinned_pieces(comptime ctm: Colour, b: *const Board, king_sq: usize) BB {
+    const all_occ = b.all_bb();
+    const ctm_occ = b.col_bb(ctm);
+    const opp = comptime ctm.opp();
+
+    const rook_queens: BB = b.piece_bb(Piece.ROOK, opp) | b.piece_bb(Piece.QUEEN, opp);
+    const bishop_queens: BB = b.piece_bb(Piece.BISHOP, opp) | b.piece_bb(Piece.QUEEN, opp);
+
+    // sliders that would attack the king if one of our pieces was removed
+    var pinners: BB = (lookup_rook_xray(all_occ, ctm_occ, king_sq) & rook_queens) |
+        (lookup_bishop_xray(all_occ, ctm_occ, king_sq) & bishop_queens);
+
+    var pinned: BB = 0;
+    while (pinners > 0) : (pinners &= pinners - 1) {
+        pinned |= between(king_sq, @ctz(pinners)) & ctm_occ;
+    }
+
+    return pinned;
+}
+
+// the pieces of colour c that are pinned to their king and can't move to sq,
+// as they would leave the line of the pin
+pub fn pinned_away_from(b: *const Board, c: Colour, sq: usize) BB {
+    const king_sq: usize = @ctz(b.piece_bb(Piece.KING, c));
+    var pinned = switch (c) {
+        inline else => |ctm| pinned_pieces(ctm, b, king_sq),
+    };
+
+    var stuck: BB = 0;
+    while (pinned > 0) : (pinned &= pinned - 1) {
+        const from: usize = @ctz(pinned);
+        if (line(king_sq, from) & square(sq) == 0) stuck |= square(from);
+    }
+    return stuck;
+}
+
+fn pawn_attacks(comptime c: Colour, pawns: BB) BB {
+    if (comptime c == Colour.WHITE) {
+        return ((pawns & ~@intFromEnum(File.FA)) << 7) | ((pawns & ~@intFromEnum(File.FH)) << 9);
+    } else {
+        return ((pawns & ~@intFromEnum(File.FA)) >> 9) | ((pawns & ~@intFromEnum(File.FH)) >> 7);
+    }
+}
+
+// every square attacked by c, with sliders blocked by occ
+pub fn attacked_sqs(comptime c: Colour, b: *const Board, occ: BB) BB {
+    var atts: BB = pawn_attacks(c, b.piece_bb(Piece.PAWN, c));
+
+    var knights = b.piece_bb(Piece.KNIGHT, c);
+    while (knights > 0) : (knights &= knights - 1) atts |= knight_move(@ctz(knights));
+
+    atts |= king_move(@ctz(b.piece_bb(Piece.KING, c)));
+
+    const queens = b.piece_bb(Piece.QUEEN, c);
+
+    var rook_likes = b.piece_bb(Piece.ROOK, c) | queens;
+    while (rook_likes > 0) : (rook_likes &= rook_likes - 1) atts |= lookup_rook(occ, @ctz(rook_likes));
+
+    var bishop_likes = b.piece_bb(Piece.BISHOP, c) | queens;
+    while (bishop_likes > 0) : (bishop_likes &= bishop_likes - 1) atts |= lookup_bishop(occ, @ctz(bishop_likes));
+
+    return atts;
+}
+
+// the pieces that mobility is counted for, in the order of AttackMaps.mobility
+pub const MOBILITY_PIECES = [4]Piece{ .KNIGHT, .BISHOP, .ROOK, .QUEEN };
+
+// everything each side attacks, built once per node by the eval (when it
+// isn't lazily skipped) and then shared with the generator and see
+pub const AttackMaps = struct {
+    // indexed like Board.pieces
+    by_piece: [12]BB,
+    // each side's sliders see through the other king, so these are also
+    // the squares the other king can't move to (see LegalInfo.danger)
+    by_colour: [2]BB,
+    by_sliders: [2]BB,
+    // squares each piece type can move to that aren't defended by an
+    // enemy pawn, summed over the pieces of that type
+    mobility: [2][MOBILITY_PIECES.len]u16,
+    // how many pieces attack the enemy king's zone (the king and the
+    // squares around it), and how many zone squares they hit between them
+    king_attackers: [2]u8,
+    king_zone_hits: [2]u8,
+
+    pub fn new(b: *const Board) AttackMaps {
+        var maps = AttackMaps{
+            .by_piece = [_]BB{0} ** 12,
+            .by_colour = .{ 0, 0 },
+            .by_sliders = .{ 0, 0 },
+            .mobility = .{ [_]u16{0} ** MOBILITY_PIECES.len, [_]u16{0} ** MOBILITY_PIECES.len },
+            .king_attackers = .{ 0, 0 },
+            .king_zone_hits = .{ 0, 0 },
+        };
+        maps.add_colour(Colour.WHITE, b);
+        maps.add_colour(Colour.BLACK, b);
+        return maps;
+    }
+
+    pub inline fn colour(self: *const AttackMaps, c: Colour) BB {
+        return self.by_colour[@intFromEnum(c)];
+    }
+
+    pub inline fn piece(self: *const AttackMaps, p: Piece) BB {
+        return self.by_piece[@intFromEnum(p)];
+    }
+
+    fn add_colour(self: *AttackMaps, comptime c: Colour, b: *const Board) void {
+        const ci = @intFromEnum(c);
+        const opp = comptime c.opp();
+
+        const opp_king_sq: usize = @ctz(b.piece_bb(Piece.KING, opp));
+        const occ = b.all_bb() ^ square(opp_king_sq);
+        const king_zone = king_move(opp_king_sq) | square(opp_king_sq);
+        const mobility_sqs = ~b.col_bb(c) & ~pawn_attacks(opp, b.piece_bb(Piece.PAWN, opp));
+
+        var atts = pawn_attacks(c, b.piece_bb(Piece.PAWN, c));
+        self.by_piece[Piece.PAWN.idx(c)] = atts;
+
+        inline for (MOBILITY_PIECES, 0..) |p, i| {
+            var piece_atts: BB = 0;
+            var pieces = b.piece_bb(p, c);
+            while (pieces > 0) : (pieces &= pieces - 1) {
+                const from: usize = @ctz(pieces);
+                const to_sqs = switch (p) {
+                    .KNIGHT => knight_move(from),
+                    .BISHOP => lookup_bishop(occ, from),
+                    .ROOK => lookup_rook(occ, from),
+                    .QUEEN => lookup_rook(occ, from) | lookup_bishop(occ, from),
+                    else => unreachable,
+                };
+
+                piece_atts |= to_sqs;
+                self.mobility[ci][i] += @popCount(to_sqs & mobility_sqs);
+
+                const zone_hits = to_sqs & king_zone;
+                if (zone_hits > 0) {
+                    self.king_attackers[ci] +|= 1;
+                    self.king_zone_hits[ci] +|= @popCount(zone_hits);
+                }
+            }
+
+            self.by_piece[p.idx(c)] = piece_atts;
+            atts |= piece_atts;
+            if (comptime p != .KNIGHT) self.by_sliders[ci] |= piece_atts;
+        }
+
+        const king_atts = king_move(@ctz(b.piece_bb(Piece.KING, c)));
+        self.by_piece[Piece.KING.idx(c)] = king_atts;
+        self.by_colour[ci] = atts | king_atts;
     }
 };
 
-fn wpawn_quiet(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.WHITE) & ~pin_sqs;
+fn wpawn_quiet(ml: *MoveList, pawns: BB, target_sqs: BB) void {
     const occ = ml.board.all_bb() | ~target_sqs;
     const quiet = pawns & ~(occ >> 8);
 
     const push = quiet & ~@intFromEnum(Rank.R7);
-    ml.add_pawn_moves_quiet(push, Piece.PAWN, 8, Piece.NONE, MoveType.QUIET);
+    ml.add_pawn_moves(push, Piece.PAWN, 8, MoveType.QUIET);
 
     const double_push = (pawns & @intFromEnum(Rank.R2)) & ~(occ >> 16) & ~(ml.board.all_bb() >> 8);
-    ml.add_pawn_moves_quiet(double_push, Piece.PAWN, 16, Piece.NONE, MoveType.DOUBLE);
+    ml.add_pawn_moves(double_push, Piece.PAWN, 16, MoveType.DOUBLE);
 
     const promo = quiet & @intFromEnum(Rank.R7);
     if (promo > 0) {
         @branchHint(.unlikely);
-        for (PROMO_PIECES_W) |p| {
-            ml.add_pawn_moves_quiet(promo, Piece.PAWN, 8, p, MoveType.PROMO);
+        inline for (PROMO_MTS) |mt| {
+            ml.add_pawn_moves(promo, Piece.PAWN, 8, mt);
         }
     }
 }
 
-fn wpawn_attack(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.WHITE) & ~pin_sqs;
+fn wpawn_attack(ml: *MoveList, pawns: BB, target_sqs: BB) void {
     const opp = ml.board.col_bb(Colour.BLACK) & target_sqs;
 
     const att_left = (pawns & ~@intFromEnum(File.FA)) & (opp >> 7);
     const att_right = (pawns & ~@intFromEnum(File.FH)) & (opp >> 9);
 
     // up left
-    ml.add_pawn_moves_cap(att_left & ~@intFromEnum(Rank.R7), Piece.PAWN, 7, .BLACK, MoveType.CAP);
+    ml.add_pawn_moves(att_left & ~@intFromEnum(Rank.R7), Piece.PAWN, 7, MoveType.CAP);
     // up right
-    ml.add_pawn_moves_cap(att_right & ~@intFromEnum(Rank.R7), Piece.PAWN, 9, .BLACK, MoveType.CAP);
+    ml.add_pawn_moves(att_right & ~@intFromEnum(Rank.R7), Piece.PAWN, 9, MoveType.CAP);
 
     const att_left_promo = att_left & @intFromEnum(Rank.R7);
     if (att_left_promo > 0) {
         @branchHint(.unlikely);
         inline for (PROMO_CAP_MTS) |mt| {
-            ml.add_pawn_moves_cap(att_left_promo, Piece.PAWN, 7, .BLACK, mt);
+            ml.add_pawn_moves(att_left_promo, Piece.PAWN, 7, mt);
         }
     }
 
@@ -343,69 +613,46 @@ fn wpawn_attack(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
     if (att_right_promo > 0) {
         @branchHint(.unlikely);
         inline for (PROMO_CAP_MTS) |mt| {
-            ml.add_pawn_moves_cap(att_right_promo, Piece.PAWN, 9, .BLACK, mt);
+            ml.add_pawn_moves(att_right_promo, Piece.PAWN, 9, mt);
         }
     }
 }
 
-fn wpawn_ep(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
-    if (ml.board.ep >= 64) {
-        @branchHint(.likely);
-        return;
-    }
-
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.WHITE) & ~pin_sqs;
-    const opp = ml.board.col_bb(Colour.BLACK) & target_sqs;
-
-    // back right
-    if ((square(ml.board.ep) & ((pawns & ~@intFromEnum(File.FA)) << 7) & opp << 8) > 0) {
-        const from = @ctz(square(ml.board.ep) >> 7);
-        ml.append(Move.new(from, from + 7, Piece.PAWN, Piece.PAWN_B, .EP));
-    }
-
-    if ((square(ml.board.ep) & ((pawns & ~@intFromEnum(File.FH)) << 9) & opp << 8) > 0) {
-        const from = @ctz(square(ml.board.ep) >> 9);
-        ml.append(Move.new(from, from + 9, Piece.PAWN, Piece.PAWN_B, .EP));
-    }
-}
-
-fn bpawn_quiet(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.BLACK) & ~pin_sqs;
+fn bpawn_quiet(ml: *MoveList, pawns: BB, target_sqs: BB) void {
     const occ = ml.board.all_bb() | ~target_sqs;
     const quiet = pawns & ~(occ << 8);
 
     const push = quiet & ~@intFromEnum(Rank.R2);
-    ml.add_pawn_moves_quiet(push, Piece.PAWN_B, -8, Piece.NONE, MoveType.QUIET);
+    ml.add_pawn_moves(push, Piece.PAWN_B, -8, MoveType.QUIET);
 
     const double_push = (pawns & @intFromEnum(Rank.R7)) & ~(occ << 16) & ~(ml.board.all_bb() << 8);
-    ml.add_pawn_moves_quiet(double_push, Piece.PAWN_B, -16, Piece.NONE, MoveType.DOUBLE);
+    ml.add_pawn_moves(double_push, Piece.PAWN_B, -16, MoveType.DOUBLE);
 
     const promo = quiet & @intFromEnum(Rank.R2);
     if (promo > 0) {
         @branchHint(.unlikely);
-        for (PROMO_PIECES_B) |p| {
-            ml.add_pawn_moves_quiet(promo, Piece.PAWN_B, -8, p, MoveType.PROMO);
+        inline for (PROMO_MTS) |mt| {
+            ml.add_pawn_moves(promo, Piece.PAWN_B, -8, mt);
         }
     }
 }
 
-fn bpawn_attack(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.BLACK) & ~pin_sqs;
+fn bpawn_attack(ml: *MoveList, pawns: BB, target_sqs: BB) void {
     const opp = ml.board.col_bb(Colour.WHITE) & target_sqs;
 
     const att_left = (pawns & ~@intFromEnum(File.FA)) & (opp << 9);
     const att_right = (pawns & ~@intFromEnum(File.FH)) & (opp << 7);
 
     // down left
-    ml.add_pawn_moves_cap(att_left & ~@intFromEnum(Rank.R2), Piece.PAWN_B, -9, .WHITE, MoveType.CAP);
+    ml.add_pawn_moves(att_left & ~@intFromEnum(Rank.R2), Piece.PAWN_B, -9, MoveType.CAP);
     // down right
-    ml.add_pawn_moves_cap(att_right & ~@intFromEnum(Rank.R2), Piece.PAWN_B, -7, .WHITE, MoveType.CAP);
+    ml.add_pawn_moves(att_right & ~@intFromEnum(Rank.R2), Piece.PAWN_B, -7, MoveType.CAP);
 
     const att_left_promo = att_left & @intFromEnum(Rank.R2);
     if (att_left_promo > 0) {
         @branchHint(.unlikely);
         inline for (PROMO_CAP_MTS) |mt| {
-            ml.add_pawn_moves_cap(att_left_promo, Piece.PAWN_B, -9, .WHITE, mt);
+            ml.add_pawn_moves(att_left_promo, Piece.PAWN_B, -9, mt);
         }
     }
 
@@ -413,55 +660,84 @@ fn bpawn_attack(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
     if (att_right_promo > 0) {
         @branchHint(.unlikely);
         inline for (PROMO_CAP_MTS) |mt| {
-            ml.add_pawn_moves_cap(att_right_promo, Piece.PAWN_B, -7, .WHITE, mt);
+            ml.add_pawn_moves(att_right_promo, Piece.PAWN_B, -7, mt);
         }
     }
 }
 
-fn bpawn_ep(ml: *MoveList, pin_sqs: BB, target_sqs: BB) void {
+// pinned pawns can only move along their pin, so each one gets its own mask
+fn pawn_moves(comptime ctm: Colour, ml: *MoveList, info: *const LegalInfo, comptime gen_fn: fn (ml: *MoveList, pawns: BB, target_sqs: BB) void) void {
+    const pawns = ml.board.piece_bb(Piece.PAWN, ctm);
+    gen_fn(ml, pawns & ~info.pinned, info.check_mask);
+
+    var pinned = pawns & info.pinned;
+    while (pinned > 0) : (pinned &= pinned - 1) {
+        const from: usize = @ctz(pinned);
+        gen_fn(ml, square(from), info.check_mask & line(info.king_sq, from));
+    }
+}
+
+fn pawn_ep(comptime ctm: Colour, ml: *MoveList, info: *const LegalInfo) void {
     if (ml.board.ep >= 64) {
         @branchHint(.likely);
         return;
     }
 
-    const pawns = ml.board.piece_bb(Piece.PAWN, Colour.BLACK) & ~pin_sqs;
-    const opp = ml.board.col_bb(Colour.WHITE) & target_sqs;
-
-    // down left
-    if ((square(ml.board.ep) & ((pawns & ~@intFromEnum(File.FA)) >> 9) & opp >> 8) > 0) {
-        const from = @ctz(square(ml.board.ep) << 9);
-        ml.append(Move.new(from, from - 9, Piece.PAWN_B, Piece.PAWN, .EP));
+    const ep: usize = ml.board.ep;
+    // the pawn that just double pushed is one square past the ep square
+    const cap_sq: usize = if (comptime ctm == Colour.WHITE) ep - 8 else ep + 8;
+
+    // our pawns that can take are on the squares an opposing pawn on the ep
+    // square would attack
+    var pawns = pawn_att(ep, comptime ctm.opp()) & ml.board.piece_bb(Piece.PAWN, ctm);
+    while (pawns > 0) : (pawns &= pawns - 1) {
+        const from: usize = @ctz(pawns);
+        if (ep_is_legal(ctm, ml.board, info, from, ep, cap_sq)) {
+            ml.append(Move.new(from, ep, .EP), comptime Piece.PAWN.with_ctm(ctm));
+        }
     }
+}
 
-    // down right
-    if ((square(ml.board.ep) & ((pawns & ~@intFromEnum(File.FH)) >> 7) & opp >> 8) > 0) {
-        const from = @ctz(square(ml.board.ep) << 7);
-        ml.append(Move.new(from, from - 7, Piece.PAWN_B, Piece.PAWN, .EP));
-    }
+// ep takes two pieces off the board at once (possibly both off the king's
+// rank), so rather than special casing pins just look at what attacks the
+// king after the move
+fn ep_is_legal(comptime ctm: Colour, b: *const Board, info: *const LegalInfo, from: usize, to: usize, cap_sq: usize) bool {
+    const opp = comptime ctm.opp();
+    const occ = (b.all_bb() ^ square(from) ^ square(cap_sq)) | square(to);
+
+    const rook_queens: BB = b.piece_bb(Piece.ROOK, opp) | b.piece_bb(Piece.QUEEN, opp);
+    const bishop_queens: BB = b.piece_bb(Piece.BISHOP, opp) | b.piece_bb(Piece.QUEEN, opp);
+
+    var atts: BB = 0;
+    atts |= lookup_rook(occ, info.king_sq) & rook_queens;
+    atts |= lookup_bishop(occ, info.king_sq) & bishop_queens;
+    // a pawn or knight check is only stopped if the checker is the pawn taken
+    atts |= info.checkers & (b.piece_bb(Piece.PAWN, opp) | b.piece_bb(Piece.KNIGHT, opp)) & ~square(cap_sq);
+
+    return atts == 0;
 }
 
-fn piece_quiet(ml: *MoveList, comptime piece: Piece, comptime move_fn: fn (occ: BB, from: usize) BB, pin_sqs: BB, target_sqs: BB) void {
-    var pieces = ml.board.piece_bb(piece, ml.board.ctm) & ~pin_sqs;
+fn piece_quiet(comptime ctm: Colour, ml: *MoveList, comptime piece: Piece, comptime move_fn: fn (occ: BB, from: usize) BB, info: *const LegalInfo, target_sqs: BB) void {
+    var pieces = ml.board.piece_bb(piece, ctm);
 
     while (pieces > 0) : (pieces &= pieces - 1) {
         const from: usize = @ctz(pieces);
-        // const moves: BB = move_fn(b.all_bb(), from) & ~b.all_bb() & target_sqs;
         const move_bb = move_fn(ml.board.all_bb(), from);
         const not_all = ~ml.board.all_bb();
-        const moves = move_bb & not_all & target_sqs;
+        const moves = move_bb & not_all & target_sqs & info.pin_mask(from);
 
-        ml.add_quiets(from, moves, piece.with_ctm(ml.board.ctm), MoveType.QUIET);
+        ml.add_moves(from, moves, comptime piece.with_ctm(ctm), MoveType.QUIET);
     }
 }
 
-fn piece_attack(ml: *MoveList, comptime piece: Piece, comptime move_fn: fn (occ: BB, from: usize) BB, pin_sqs: BB, target_sqs: BB) void {
-    var pieces = ml.board.piece_bb(piece, ml.board.ctm) & ~pin_sqs;
-    const opp = ml.board.col_bb(ml.board.ctm.opp()) & target_sqs;
+fn piece_attack(comptime ctm: Colour, ml: *MoveList, comptime piece: Piece, comptime move_fn: fn (occ: BB, from: usize) BB, info: *const LegalInfo, target_sqs: BB) void {
+    var pieces = ml.board.piece_bb(piece, ctm);
+    const opp = ml.board.col_bb(comptime ctm.opp()) & target_sqs;
 
     while (pieces > 0) : (pieces &= pieces - 1) {
         const from: usize = @ctz(pieces);
-        const moves: BB = move_fn(ml.board.all_bb(), from) & opp;
-        ml.add_caps(from, moves, piece.with_ctm(ml.board.ctm), ml.board.ctm.opp(), MoveType.CAP);
+        const moves: BB = move_fn(ml.board.all_bb(), from) & opp & info.pin_mask(from);
+        ml.add_moves(from, moves, comptime piece.with_ctm(ctm), MoveType.CAP);
     }
 }
 
@@ -499,298 +775,276 @@ pub inline fn pawn_att(sq: usize, ctm: Colour) BB {
     return pawn_attack_table[sq + (64 * @intFromEnum(ctm))];
 }
 
-fn king_castle(ml: *MoveList) void {
-    const from: usize = @ctz(ml.board.piece_bb(Piece.KING, ml.board.ctm));
+fn king_castle(comptime ctm: Colour, ml: *MoveList, info: *const LegalInfo) void {
+    // can't castle out of check
+    if (info.checkers > 0) return;
+
+    const from: usize = info.king_sq;
+    const king = comptime Piece.KING.with_ctm(ctm);
 
-    // if castle rights allow and no pieces are between king and rook
-    const shift: u6 = @intCast(@intFromEnum(ml.board.ctm) * 56);
+    // if castle rights allow, no pieces are between king and rook and the
+    // king doesn't pass through or land on an attacked square
+    const shift: u6 = comptime @intFromEnum(ctm) * 56;
     const kingside_mask: BB = @as(BB, 0x60) << shift;
-    if (ml.board.can_kingside() and (ml.board.all_bb() & kingside_mask) == 0) {
-        const mt = if (ml.board.ctm == Colour.WHITE) MoveType.WKINGSIDE else MoveType.BKINGSIDE;
-        ml.append(Move.new(from, from + 2, Piece.KING.with_ctm(ml.board.ctm), Piece.NONE, mt));
+    if (ml.board.can_kingside() and (ml.board.all_bb() & kingside_mask) == 0 and (info.danger & kingside_mask) == 0) {
+        const mt = comptime if (ctm == Colour.WHITE) MoveType.WKINGSIDE else MoveType.BKINGSIDE;
+        ml.append(Move.new(from, from + 2, mt), king);
     }
 
     const queenside_mask: BB = @as(BB, 0xE) << shift;
-    if (ml.board.can_queenside() and (ml.board.all_bb() & queenside_mask) == 0) {
-        const mt = if (ml.board.ctm == Colour.WHITE) MoveType.WQUEENSIDE else MoveType.BQUEENSIDE;
-        ml.append(Move.new(from, from - 2, Piece.KING.with_ctm(ml.board.ctm), Piece.NONE, mt));
+    // the b file only needs to be empty, the king never crosses it
+    const queenside_path: BB = @as(BB, 0xC) << shift;
+    if (ml.board.can_queenside() and (ml.board.all_bb() & queenside_mask) == 0 and (info.danger & queenside_path) == 0) {
+        const mt = comptime if (ctm == Colour.WHITE) MoveType.WQUEENSIDE else MoveType.BQUEENSIDE;
+        ml.append(Move.new(from, from - 2, mt), king);
     }
 }
 
-fn gen_all_moves(ml: *MoveList) void {
-    piece_attack(ml, Piece.QUEEN, queen_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.BISHOP, bishop_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.ROOK, rook_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.KNIGHT, knight_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.KING, king_move_wrapper, NO_SQUARES, ALL_SQUARES);
-
-    piece_quiet(ml, Piece.QUEEN, queen_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_quiet(ml, Piece.BISHOP, bishop_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_quiet(ml, Piece.ROOK, rook_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_quiet(ml, Piece.KNIGHT, knight_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_quiet(ml, Piece.KING, king_move_wrapper, NO_SQUARES, ALL_SQUARES);
+fn gen_king_moves(comptime ctm: Colour, ml: *MoveList, info: *const LegalInfo) void {
+    piece_attack(ctm, ml, Piece.KING, king_move_wrapper, info, ~info.danger);
+    piece_quiet(ctm, ml, Piece.KING, king_move_wrapper, info, ~info.danger);
+}
 
-    if (ml.board.ctm == Colour.WHITE) {
-        wpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-        wpawn_quiet(ml, NO_SQUARES, ALL_SQUARES);
-        wpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
+fn gen_pawn_moves(comptime ctm: Colour, ml: *MoveList, info: *const LegalInfo) void {
+    if (comptime ctm == Colour.WHITE) {
+        pawn_moves(ctm, ml, info, wpawn_attack);
+        pawn_moves(ctm, ml, info, wpawn_quiet);
     } else {
-        bpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-        bpawn_quiet(ml, NO_SQUARES, ALL_SQUARES);
-        bpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
+        pawn_moves(ctm, ml, info, bpawn_attack);
+        pawn_moves(ctm, ml, info, bpawn_quiet);
     }
-
-    king_castle(ml);
+    pawn_ep(ctm, ml, info);
 }
 
-fn king_safe_target(b: *const Board, king_sq: usize) BB {
-    // TODO is this the best way?
-    var king_moves = king_move(king_sq);
-    const not_king_bb = ~square(king_sq);
-    const attackers = b.ctm.opp();
-
-    var safe: BB = 0;
-    while (king_moves > 0) : (king_moves &= king_moves - 1) {
-        const to: usize = @ctz(king_moves);
-        var atts: BB = 0;
-
-        atts |= pawn_att(to, attackers.opp()) & b.piece_bb(.PAWN, attackers);
-        atts |= knight_move(to) & b.piece_bb(.KNIGHT, attackers);
-        atts |= king_move(to) & b.piece_bb(.KING, attackers);
-
-        const rq: BB = b.piece_bb(.ROOK, attackers) | b.piece_bb(.QUEEN, attackers);
-        atts |= lookup_rook(b.all_bb() & not_king_bb, to) & rq;
-
-        const bq: BB = b.piece_bb(.BISHOP, attackers) | b.piece_bb(.QUEEN, attackers);
-        atts |= lookup_bishop(b.all_bb() & not_king_bb, to) & bq;
-
-        if (atts == 0) {
-            safe |= square(to);
-        }
+// only legal moves are generated, so nothing ever has to be made just to be
+// thrown away. each colour gets its own copy of the generator so that all of
+// the piece indices, shifts and masks are constants
+pub fn gen_moves(ml: *MoveList) void {
+    switch (ml.board.ctm) {
+        inline else => |ctm| gen_moves_for(ctm, ml),
     }
-
-    return safe;
 }
 
-fn pinned_sqs(b: *const Board, king_sq: usize) BB {
-    var pinned: BB = 0;
-
-    const all_occ = b.all_bb();
-    const ctm_occ = b.col_bb(b.ctm);
-    const opp = b.ctm.opp();
+fn gen_moves_for(comptime ctm: Colour, ml: *MoveList) void {
+    const info = LegalInfo.new(ctm, ml.board, ml.maps);
 
-    const rook_queens: BB = b.piece_bb(Piece.ROOK, opp) | b.piece_bb(Piece.QUEEN, opp);
-    var rq_pinners: BB =
-        lookup_rook_xray(all_occ, ctm_occ, king_sq) & rook_queens;
+    gen_king_moves(ctm, ml, &info);
 
-    while (rq_pinners > 0) : (rq_pinners &= rq_pinners - 1) {
-        const from: BB = @ctz(rq_pinners);
-        pinned |= lookup_rook(all_occ, from);
-    }
+    // in double check only the king can move
+    if (info.is_double_check()) return;
 
-    const bishop_queens: BB = b.piece_bb(Piece.BISHOP, opp) | b.piece_bb(Piece.QUEEN, opp);
-    var bq_pinners: BB = lookup_bishop_xray(all_occ, ctm_occ, king_sq) &
-        bishop_queens;
+    const targets = info.check_mask;
+    piece_attack(ctm, ml, Piece.QUEEN, queen_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.BISHOP, bishop_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.ROOK, rook_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.KNIGHT, knight_move_wrapper, &info, targets);
 
-    while (bq_pinners > 0) : (bq_pinners &= bq_pinners - 1) {
-        const from: BB = @ctz(bq_pinners);
-        const lookup = lookup_bishop(all_occ, from);
-        pinned |= lookup;
-    }
+    piece_quiet(ctm, ml, Piece.QUEEN, queen_move_wrapper, &info, targets);
+    piece_quiet(ctm, ml, Piece.BISHOP, bishop_move_wrapper, &info, targets);
+    piece_quiet(ctm, ml, Piece.ROOK, rook_move_wrapper, &info, targets);
+    piece_quiet(ctm, ml, Piece.KNIGHT, knight_move_wrapper, &info, targets);
 
-    if (pinned > 0) {
-        const potential_pins = (lookup_rook(all_occ, king_sq) | lookup_bishop(all_occ, king_sq)) & ctm_occ;
-        pinned &= potential_pins;
-    }
+    gen_pawn_moves(ctm, ml, &info);
 
-    return pinned;
+    king_castle(ctm, ml, &info);
 }
 
-fn attacker_ray(b: *const Board, king_sq: usize, att_sq: usize) BB {
-    // if (square(att_sq) & consts.bishop_magics[king_sq].mask > 0) {
-    if (king_sq % 8 == att_sq % 8 or king_sq / 8 == att_sq / 8) {
-        return lookup_rook(b.all_bb(), king_sq) &
-            lookup_rook(b.all_bb(), att_sq);
-    } else {
-        return lookup_bishop(b.all_bb(), king_sq) &
-            lookup_bishop(b.all_bb(), att_sq);
+// legal captures only, for quiescence
+pub fn gen_q_moves(ml: *MoveList) void {
+    switch (ml.board.ctm) {
+        inline else => |ctm| gen_q_moves_for(ctm, ml),
     }
 }
 
-fn gen_check_moves(ml: *MoveList) void {
-    const king_sq: usize = @ctz(ml.board.piece_bb(Piece.KING, ml.board.ctm));
-
-    const attackers = ml.board.attackers_of_sq(king_sq, ml.board.ctm.opp());
-    const safe_moves = king_safe_target(ml.board, king_sq);
-
-    piece_quiet(ml, Piece.KING, king_move_wrapper, NO_SQUARES, safe_moves);
-    piece_attack(ml, Piece.KING, king_move_wrapper, NO_SQUARES, safe_moves);
-
-    // if there is more than one attacker there is nothing else to do
-    if (attackers & (attackers - 1) > 0) {
-        // log.debug("more than one attacker", .{});
-        return;
-    }
-
-    const pinned = pinned_sqs(ml.board, king_sq);
+fn gen_q_moves_for(comptime ctm: Colour, ml: *MoveList) void {
+    const info = LegalInfo.new(ctm, ml.board, ml.maps);
 
-    piece_attack(ml, Piece.QUEEN, queen_move_wrapper, pinned, attackers);
-    piece_attack(ml, Piece.BISHOP, bishop_move_wrapper, pinned, attackers);
-    piece_attack(ml, Piece.ROOK, rook_move_wrapper, pinned, attackers);
-    piece_attack(ml, Piece.KNIGHT, knight_move_wrapper, pinned, attackers);
+    piece_attack(ctm, ml, Piece.KING, king_move_wrapper, &info, ~info.danger);
+    if (info.is_double_check()) return;
 
-    if (ml.board.ctm == Colour.WHITE) {
-        wpawn_attack(ml, pinned, attackers);
-        wpawn_ep(ml, pinned, attackers);
-    } else {
-        bpawn_attack(ml, pinned, attackers);
-        bpawn_ep(ml, pinned, attackers);
-    }
+    const targets = info.check_mask;
+    piece_attack(ctm, ml, Piece.QUEEN, queen_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.BISHOP, bishop_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.ROOK, rook_move_wrapper, &info, targets);
+    piece_attack(ctm, ml, Piece.KNIGHT, knight_move_wrapper, &info, targets);
+    pawn_moves(ctm, ml, &info, if (ctm == Colour.WHITE) wpawn_attack else bpawn_attack);
+    pawn_ep(ctm, ml, &info);
+}
 
-    const att_sq: usize = @ctz(attackers);
-    // if the attacker is not a sliding piece then no other quiet moves will
-    // make any difference
-    // const att_piece = ml.board.get_piece(att_sq);
-    const att_piece = ml.board.get_piece_not_none(att_sq, ml.board.ctm.opp());
-    if (!att_piece.is_slider()) {
-        return;
+pub fn gen_piece_moves(ml: *MoveList, p: Piece) void {
+    switch (ml.board.ctm) {
+        inline else => |ctm| gen_piece_moves_for(ctm, ml, p),
     }
-
-    const att_ray = attacker_ray(ml.board, king_sq, att_sq);
-
-    piece_quiet(ml, Piece.QUEEN, queen_move_wrapper, pinned, att_ray);
-    piece_quiet(ml, Piece.BISHOP, bishop_move_wrapper, pinned, att_ray);
-    piece_quiet(ml, Piece.ROOK, rook_move_wrapper, pinned, att_ray);
-    piece_quiet(ml, Piece.KNIGHT, knight_move_wrapper, pinned, att_ray);
-
-    if (ml.board.ctm == Colour.WHITE) wpawn_quiet(ml, pinned, att_ray) else bpawn_quiet(ml, pinned, att_ray);
 }
 
-pub fn gen_moves(ml: *MoveList, checked: bool) void {
-    if (checked) gen_check_moves(ml) else gen_all_moves(ml);
-}
+fn gen_piece_moves_for(comptime ctm: Colour, ml: *MoveList, p: Piece) void {
+    const info = LegalInfo.new(ctm, ml.board, ml.maps);
 
-pub fn gen_q_moves(ml: *MoveList) void {
-    piece_attack(ml, Piece.QUEEN, queen_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.BISHOP, bishop_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.ROOK, rook_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    piece_attack(ml, Piece.KNIGHT, knight_move_wrapper, NO_SQUARES, ALL_SQUARES);
-    if (ml.board.ctm == Colour.WHITE) {
-        wpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-        wpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
-    } else {
-        bpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-        bpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
-    }
-}
+    if (info.is_double_check() and p != .KING and p != .KING_B) return;
+    const targets = info.check_mask;
 
-pub fn gen_piece_moves(ml: *MoveList, p: Piece) void {
     switch (p) {
         .QUEEN, .QUEEN_B => {
-            piece_attack(ml, Piece.QUEEN, queen_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            piece_quiet(ml, Piece.QUEEN, queen_move_wrapper, NO_SQUARES, ALL_SQUARES);
+            piece_attack(ctm, ml, Piece.QUEEN, queen_move_wrapper, &info, targets);
+            piece_quiet(ctm, ml, Piece.QUEEN, queen_move_wrapper, &info, targets);
         },
         .BISHOP, .BISHOP_B => {
-            piece_attack(ml, Piece.BISHOP, bishop_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            piece_quiet(ml, Piece.BISHOP, bishop_move_wrapper, NO_SQUARES, ALL_SQUARES);
+            piece_attack(ctm, ml, Piece.BISHOP, bishop_move_wrapper, &info, targets);
+            piece_quiet(ctm, ml, Piece.BISHOP, bishop_move_wrapper, &info, targets);
         },
         .ROOK, .ROOK_B => {
-            piece_attack(ml, Piece.ROOK, rook_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            piece_quiet(ml, Piece.ROOK, rook_move_wrapper, NO_SQUARES, ALL_SQUARES);
+            piece_attack(ctm, ml, Piece.ROOK, rook_move_wrapper, &info, targets);
+            piece_quiet(ctm, ml, Piece.ROOK, rook_move_wrapper, &info, targets);
         },
         .KNIGHT, .KNIGHT_B => {
-            piece_attack(ml, Piece.KNIGHT, knight_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            piece_quiet(ml, Piece.KNIGHT, knight_move_wrapper, NO_SQUARES, ALL_SQUARES);
+            piece_attack(ctm, ml, Piece.KNIGHT, knight_move_wrapper, &info, targets);
+            piece_quiet(ctm, ml, Piece.KNIGHT, knight_move_wrapper, &info, targets);
         },
         .KING, .KING_B => {
-            piece_attack(ml, Piece.KING, king_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            piece_quiet(ml, Piece.KING, king_move_wrapper, NO_SQUARES, ALL_SQUARES);
-            king_castle(ml);
-        },
-        .PAWN => {
-            wpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-            wpawn_quiet(ml, NO_SQUARES, ALL_SQUARES);
-            wpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
-        },
-        .PAWN_B => {
-            bpawn_attack(ml, NO_SQUARES, ALL_SQUARES);
-            bpawn_quiet(ml, NO_SQUARES, ALL_SQUARES);
-            bpawn_ep(ml, NO_SQUARES, ALL_SQUARES);
+            gen_king_moves(ctm, ml, &info);
+            king_castle(ctm, ml, &info);
         },
+        .PAWN, .PAWN_B => gen_pawn_moves(ctm, ml, &info),
         .NONE => {},
     }
 }
 
-fn castle_is_legal(b: *const Board, comptime sq1: usize, comptime sq2: usize, comptime attacker: Colour) bool {
-    const can_sq1: bool = b.attackers_of_sq(sq1, attacker) == 0;
-    const can_sq2: bool = b.attackers_of_sq(sq2, attacker) == 0;
-    return can_sq1 and can_sq2;
-}
-
 const REP_SIZE: usize = 1 << 16;
 const REP_MASK: usize = REP_SIZE - 1;
 
-var repetitions: [REP_SIZE]usize = [_]usize{0} ** REP_SIZE;
+// counts how many times each (masked) hash has been seen in the game and the
+// current search line, each engine context owns one of these
+pub const Repetitions = struct {
+    counts: [REP_SIZE]u16,
 
-pub fn push_repetition(hash: u64) void {
-    repetitions[hash & REP_MASK] += 1;
-}
+    pub fn push(self: *Repetitions, hash: u64) void {
+        self.counts[hash & REP_MASK] += 1;
+    }
 
-pub fn pop_repetition(hash: u64) void {
-    std.debug.assert(repetitions[hash & REP_MASK] > 0);
-    repetitions[hash & REP_MASK] -= 1;
-}
+    pub fn pop(self: *Repetitions, hash: u64) void {
+        std.debug.assert(self.counts[hash & REP_MASK] > 0);
+        self.counts[hash & REP_MASK] -= 1;
+    }
 
-pub fn clear_repetitions() void {
-    for (0..REP_SIZE) |i| repetitions[i] = 0;
-}
+    pub fn clear(self: *Repetitions) void {
+        @memset(&self.counts, 0);
+    }
+
+    pub fn get(self: *const Repetitions, hash: u64) usize {
+        return self.counts[hash & REP_MASK];
+    }
 
-pub fn get_repetitions(hash: u64) usize {
-    return repetitions[hash & REP_MASK];
+    // assumes the move that lead to b has already been applied
+    pub fn is_draw(self: *const Repetitions, b: *const Board) bool {
+        return b.halfmove > 100 or self.get(b.hash) > 2;
+    }
+};
+
+const RSHIFT = 12; // !
+const BSHIFT = 9;
+
+// pext only exists on x86_64, everything else (eg. aarch64 android) always
+// uses the magics
+const is_x86_64 = builtin.cpu.arch == .x86_64;
+const target_has_bmi2 = is_x86_64 and std.Target.x86.featureSetHas(builtin.cpu.features, .bmi2);
+
+pub const SliderLookup = enum { magic, pext, dispatch };
+
+// picked by the slider_lookup build option, dispatch checks cpuid once at
+// startup (see detect_cpu_features) for builds that have to run anywhere
+pub const slider_lookup: SliderLookup = if (!is_x86_64) .magic else switch (config.slider_lookup) {
+    .auto => if (target_has_bmi2) .pext else .magic,
+    .magic => .magic,
+    .pext => .pext,
+    .dispatch => if (target_has_bmi2) .pext else .dispatch,
+};
+
+// only written by the first detect_cpu_features, which every engine calls
+// before it can search, so the lookups never race with the write
+var runtime_has_pext = false;
+var detect_once = std.once(detect_pext);
+
+fn detect_pext() void {
+    runtime_has_pext = cpu_has_bmi2();
 }
 
-// assumes the move has already been applied to the board
-pub fn is_legal_move(b: *const Board, m: Move, checked: bool) bool {
-    if (b.halfmove > 100 or get_repetitions(b.hash) > 2) return false;
-    if (get_repetitions(b.hash) > 2) return false;
+// only needed for dispatch builds, everything falls back to the magics until
+// this has been called. cpuid is only checked the first time, so this is
+// safe to call from every thread that creates an engine
+pub fn detect_cpu_features() void {
+    if (comptime slider_lookup != .dispatch) return;
+    detect_once.call();
+}
 
-    // checked has legal move gen and no casling is required
-    if (checked) {
-        return true;
-    }
+pub fn pext_supported() bool {
+    if (comptime !is_x86_64) return false;
+    return target_has_bmi2 or cpu_has_bmi2();
+}
 
-    switch (m.mt) {
-        MoveType.WKINGSIDE => return castle_is_legal(b, 5, 6, Colour.BLACK),
-        MoveType.WQUEENSIDE => return castle_is_legal(b, 3, 2, Colour.BLACK),
-        MoveType.BKINGSIDE => return castle_is_legal(b, 61, 62, Colour.WHITE),
-        MoveType.BQUEENSIDE => return castle_is_legal(b, 59, 58, Colour.WHITE),
-        else => {},
-    }
+fn cpu_has_bmi2() bool {
+    var eax: u32 = undefined;
+    var ebx: u32 = undefined;
+    var ecx: u32 = undefined;
+    var edx: u32 = undefined;
+
+    // structured extended features, bmi2 is bit 8 of ebx
+    asm volatile ("cpuid"
+        : [_] "={eax}" (eax),
+          [_] "={ebx}" (ebx),
+          [_] "={ecx}" (ecx),
+          [_] "={edx}" (edx),
+        : [_] "{eax}" (@as(u32, 7)),
+          [_] "{ecx}" (@as(u32, 0)),
+    );
+
+    return (ebx >> 8) & 1 == 1;
+}
 
-    // check if moved into check
-    const ksq: usize = @ctz(b.piece_bb(Piece.KING, b.ctm.opp()));
-    if ((square(m.to) | square(m.from)) & super_moves[ksq] > 0 and b.attackers_of_sq(ksq, b.ctm) > 0) {
-        return false;
+inline fn pext(src: u64, mask: u64) u64 {
+    if (comptime target_has_bmi2) {
+        return asm ("pextq %[mask], %[src], %[ret]"
+            : [ret] "=r" (-> u64),
+            : [src] "r" (src),
+              [mask] "r" (mask),
+        );
     }
 
-    return true;
+    // the assembler won't take the mnemonic without bmi2 enabled for the
+    // target, these bytes are pext rax, rcx, rdx
+    return asm (".byte 0xc4, 0xe2, 0xf2, 0xf5, 0xc2"
+        : [ret] "={rax}" (-> u64),
+        : [src] "{rcx}" (src),
+          [mask] "{rdx}" (mask),
+    );
 }
 
-pub fn is_legal_q_move(b: *const Board, m: Move) bool {
-    // check if moved into check
-    const ksq: usize = @ctz(b.piece_bb(Piece.KING, b.ctm.opp()));
+pub inline fn lookup_bishop(occ: BB, sq: usize) BB {
+    return switch (slider_lookup) {
+        .magic => lookup_bishop_magic(occ, sq),
+        .pext => lookup_bishop_pext(occ, sq),
+        .dispatch => if (runtime_has_pext) lookup_bishop_pext(occ, sq) else lookup_bishop_magic(occ, sq),
+    };
+}
 
-    if ((square(m.to) | square(m.from)) & super_moves[ksq] > 0 and b.attackers_of_sq(ksq, b.ctm) > 0) {
-        return false;
-    }
+pub inline fn lookup_rook(occ: BB, sq: usize) BB {
+    return switch (slider_lookup) {
+        .magic => lookup_rook_magic(occ, sq),
+        .pext => lookup_rook_pext(occ, sq),
+        .dispatch => if (runtime_has_pext) lookup_rook_pext(occ, sq) else lookup_rook_magic(occ, sq),
+    };
+}
 
-    return true;
+pub inline fn lookup_bishop_pext(occ: BB, sq: usize) BB {
+    const e = bishop_pext[sq];
+    return bishop_pext_table[e.offset + pext(occ, e.mask)];
 }
 
-const RSHIFT = 12; // !
-const BSHIFT = 9;
+pub inline fn lookup_rook_pext(occ: BB, sq: usize) BB {
+    const e = rook_pext[sq];
+    return rook_pext_table[e.offset + pext(occ, e.mask)];
+}
 
-pub inline fn lookup_bishop(occ: BB, sq: usize) BB {
+pub inline fn lookup_bishop_magic(occ: BB, sq: usize) BB {
     var o = occ;
     o &= bishop_magics[sq].mask;
     o = @mulWithOverflow(o, bishop_magics[sq].magic).@"0";
@@ -805,7 +1059,7 @@ pub fn lookup_bishop_xray(occ: BB, blockers: BB, sq: usize) BB {
     return atts ^ lookup_bishop(occ ^ blk, sq);
 }
 
-pub inline fn lookup_rook(occ: BB, sq: usize) BB {
+pub inline fn lookup_rook_magic(occ: BB, sq: usize) BB {
     var o = occ;
     o &= rook_magics[sq].mask;
     o = @mulWithOverflow(o, rook_magics[sq].magic).@"0";
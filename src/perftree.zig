@@ -16,19 +16,22 @@ fn perftree(b: *Board, depth: usize) usize {
 
     var mc: usize = 0;
 
-    var ml = movegen.MoveList.new(b, null);
-    const checked = b.is_in_check();
-    movegen.gen_moves(&ml, checked);
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
 
     var next: Board = undefined;
     while (ml.next()) |m| {
-        b.copy_make(&next, m);
-
-        if (!movegen.is_legal_move(&next, m, checked)) {
-            continue;
+        switch (board.make_mode) {
+            .copy => {
+                b.copy_make(&next, m);
+                mc += perftree(&next, depth - 1);
+            },
+            .unmake => {
+                const undo = b.make(m);
+                mc += perftree(b, depth - 1);
+                b.unmake(m, undo);
+            },
         }
-
-        mc += perftree(&next, depth - 1);
     }
 
     return mc;
@@ -37,18 +40,13 @@ fn perftree(b: *Board, depth: usize) usize {
 fn perftree_root(w: *std.Io.Writer, b: *Board, depth: usize) !void {
     var total_mc: usize = 0;
 
-    var ml = movegen.MoveList.new(b, null);
-    const checked = b.is_in_check();
-    movegen.gen_moves(&ml, checked);
+    var ml = movegen.MoveList.new(b, null, null);
+    movegen.gen_moves(&ml);
 
     var next: Board = undefined;
     while (ml.next()) |m| {
         b.copy_make(&next, m);
 
-        if (!movegen.is_legal_move(&next, m, checked)) {
-            continue;
-        }
-
         const mc = perftree(&next, depth - 1);
         total_mc += mc;
         try m.as_uci_str(w);
@@ -59,6 +57,8 @@ fn perftree_root(w: *std.Io.Writer, b: *Board, depth: usize) !void {
 }
 
 pub fn main() !void {
+    movegen.detect_cpu_features();
+
     var it = std.process.args();
     _ = it.skip();
 
@@ -69,7 +69,7 @@ pub fn main() !void {
     var b = try board.board_from_fen(arg);
 
     if (it.next()) |move_str| {
-        b = try uci.process_moves(b, move_str);
+        b = try uci.process_moves(b, move_str, null);
     }
 
     log.debug("perftree position is:", .{});
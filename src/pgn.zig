@@ -85,12 +85,12 @@ fn alg_is_castling(alg: []const u8, ctm: board.Colour) ?Move {
     const shift: usize = @intCast(@intFromEnum(ctm) * 56);
     if (std.mem.eql(u8, alg, "O-O")) {
         const mt: movegen.MoveType = if (ctm == .WHITE) .WKINGSIDE else .BKINGSIDE;
-        return Move.new(4 + shift, 6 + shift, Piece.KING.with_ctm(ctm), .NONE, mt);
+        return Move.new(4 + shift, 6 + shift, mt);
     }
 
     if (std.mem.eql(u8, alg, "O-O-O")) {
         const mt: movegen.MoveType = if (ctm == .WHITE) .WQUEENSIDE else .BQUEENSIDE;
-        return Move.new(4 + shift, 2 + shift, Piece.KING.with_ctm(ctm), .NONE, mt);
+        return Move.new(4 + shift, 2 + shift, mt);
     }
 
     return null;
@@ -117,7 +117,7 @@ pub fn algebraic_to_move(b: *const Board, algebraic: []const u8) !Move {
     alg = try alg_take_to_sq(alg, &to);
 
     // TODO would be cool (and quicker) to only generate the moves for that specific piece
-    var ml = movegen.MoveList.new(b, null);
+    var ml = movegen.MoveList.new(b, null, null);
     movegen.gen_piece_moves(&ml, piece);
 
     std.log.debug("in: {s}\npiece: {s}\nfile: {s}\nrank: {s}\ncap: {s}\nto: {d}\n", .{
@@ -135,7 +135,7 @@ pub fn algebraic_to_move(b: *const Board, algebraic: []const u8) !Move {
 
         if (file) |f| if (board.square(m.from) & @intFromEnum(f) == 0) continue;
         if (rank) |r| if (board.square(m.from) & @intFromEnum(r) == 0) continue;
-        if ((m.xpiece != .NONE) != cap) continue;
+        if (m.mt.is_cap() != cap) continue;
         if (m.to != to) continue;
         std.log.debug("matched!\n\n", .{});
         return m;
@@ -0,0 +1,100 @@
+const std = @import("std");
+
+const board = @import("board.zig");
+const Board = board.Board;
+const movegen = @import("movegen.zig");
+const Move = movegen.Move;
+const search = @import("search.zig");
+const eval = @import("eval.zig");
+const tt = @import("tt.zig");
+const PV = tt.PV;
+const uci = @import("uci.zig");
+const UCI = uci.UCI;
+
+// analyses every position of a game in one call, for game review. the game
+// is walked from the last position back to the first without clearing the
+// tt, so each search starts with what was learnt about the positions after it
+
+// the analysis of the position before the ply'th move (the last one is the
+// final position), scores are from the side to move's point of view
+pub const PlyReview = struct {
+    score: i32,
+    // Move.NONE if the game was already over in this position
+    best_move: Move,
+    pv: PV,
+};
+
+// called after each position has been searched
+pub const ProgressListener = struct {
+    ctx: *anyopaque,
+    on_progress: *const fn (ctx: *anyopaque, done: usize, total: usize) void,
+};
+
+// position is a uci position command. every position gets the same limits,
+// the engine's stop flag ends the review early with error.ReviewStopped.
+// the caller owns the returned slice
+pub fn review_game(
+    allocator: std.mem.Allocator,
+    u: *UCI,
+    position: []const u8,
+    limits: search.Limits,
+    progress: ?ProgressListener,
+) ![]PlyReview {
+    var positions = std.ArrayList(Board).empty;
+    defer positions.deinit(allocator);
+
+    try positions.append(allocator, try uci.parse_position_start(position));
+    if (uci.position_moves(position)) |moves| {
+        var it = std.mem.splitScalar(u8, moves, ' ');
+        while (it.next()) |s| {
+            if (s.len == 0) continue;
+            const curr = positions.items[positions.items.len - 1];
+            const m = try movegen.parse_uci_move_legal(curr, s);
+            var next: Board = undefined;
+            curr.copy_make(&next, m);
+            try positions.append(allocator, next);
+        }
+    }
+
+    const reviews = try allocator.alloc(PlyReview, positions.items.len);
+    errdefer allocator.free(reviews);
+
+    u.engine.tt.clear();
+
+    var done: usize = 0;
+    var i = positions.items.len;
+    while (i > 0) {
+        i -= 1;
+        if (u.engine.stop.load(.monotonic)) return error.ReviewStopped;
+
+        // the game up to this position, for repetitions
+        u.engine.reps.clear();
+        for (positions.items[0 .. i + 1]) |b| u.engine.reps.push(b.hash);
+        u.board = positions.items[i];
+
+        reviews[i] = try review_position(u, limits);
+        u.engine.tt.new_search();
+
+        done += 1;
+        if (progress) |p| p.on_progress(p.ctx, done, positions.items.len);
+    }
+
+    return reviews;
+}
+
+fn review_position(u: *UCI, limits: search.Limits) !PlyReview {
+    var r = PlyReview{ .score = 0, .best_move = Move.NONE, .pv = PV.init() };
+
+    // the search has nothing to return once the game is over
+    var ml = movegen.MoveList.new(&u.board, null, null);
+    movegen.gen_moves(&ml);
+    if (ml.count == 0) {
+        r.score = if (u.board.is_in_check()) -eval.CHECKMATE else eval.STALEMATE;
+        return r;
+    }
+
+    const res = try search.do_search_pv(u, limits, &r.pv);
+    r.score = res.score;
+    r.best_move = res.move;
+    return r;
+}
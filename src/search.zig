@@ -9,10 +9,26 @@ const tt = @import("tt.zig");
 const PV = tt.PV;
 const eval = @import("eval.zig");
 const UCI = @import("uci.zig").UCI;
+const Engine = @import("engine.zig").Engine;
 const Timer = @import("timer.zig").Timer;
+const trace = @import("trace.zig");
+const endgame = @import("endgame.zig");
 
 pub const MAX_DEPTH = 200;
-const TIMEOUT_MS: u64 = 7000;
+pub const TIMEOUT_MS: u64 = 7000;
+
+// quiet moves that lose more than this much per ply of depth left are not
+// searched near the leaves
+const SEE_QUIET_PRUNE_DEPTH = 3;
+const SEE_QUIET_MARGIN = 60;
+
+// qsearch results go in the tt below any real search depth so they never
+// replace a full search entry, evasions are worth more than captures only
+const QS_TT_DEPTH_CHECKED = 0;
+const QS_TT_DEPTH = -1;
+
+// enough for a full depth line plus the longest qsearch on the end of it
+const UNDO_STACK_SIZE = MAX_DEPTH + 128;
 // const TIMEOUT_MS: u64 = std.math.maxInt(u64);
 
 pub const SearchResult = struct {
@@ -20,24 +36,40 @@ pub const SearchResult = struct {
     move: Move,
 };
 
-pub fn do_search(uci: *UCI) !SearchResult {
-    return iterative_deepening(uci);
+// the budget for a single search, whichever runs out first stops the search
+pub const Limits = struct {
+    movetime_ms: u64 = TIMEOUT_MS,
+    nodes: ?usize = null,
+    depth: usize = MAX_DEPTH - 1,
+    // go mate, runs the mate search (see mate.zig) instead
+    mate: ?usize = null,
+};
+
+pub fn do_search(uci: *UCI, limits: Limits) !SearchResult {
+    var pv = PV.init();
+    return iterative_deepening(uci, limits, &pv);
+}
+
+// like do_search, but leaves the principal variation in pv
+pub fn do_search_pv(uci: *UCI, limits: Limits, pv: *PV) !SearchResult {
+    return iterative_deepening(uci, limits, pv);
 }
 
-fn iterative_deepening(uci: *UCI) !SearchResult {
+fn iterative_deepening(uci: *UCI, limits: Limits, pv: *PV) !SearchResult {
     var res: ?SearchResult = null;
     var timer = try Timer().init();
 
-    var pv = PV.init();
+    var total_nodes: usize = 0;
 
-    for (1..MAX_DEPTH) |depth| {
+    for (1..@min(limits.depth, MAX_DEPTH - 1) + 1) |depth| {
         // for (1..4) |depth| {
         std.log.debug("trying depth {d}", .{depth});
-        var searcher = Searcher.init(&timer, @intCast(depth));
-        res = root_search(&searcher, &pv, &uci.board, -eval.INF, eval.INF, @intCast(depth)) catch |err| {
+        var searcher = Searcher.init(uci.engine, &timer, &limits, total_nodes, @intCast(depth));
+        res = root_search(&searcher, pv, &uci.board, -eval.INF, eval.INF, @intCast(depth)) catch |err| {
             switch (err) {
                 error.FailLow => {
                     try uci.log_uci_error("root search failed low, trying next depth", .{});
+                    total_nodes += searcher.nodes + searcher.qnodes;
                     continue;
                 },
                 error.OutOfTime => break,
@@ -45,46 +77,113 @@ fn iterative_deepening(uci: *UCI) !SearchResult {
             }
         };
 
-        try uci.send_info(res.?, &pv, searcher.timer, searcher.nodes, depth);
+        total_nodes += searcher.nodes + searcher.qnodes;
+        try uci.send_info(res.?, pv, searcher.timer, searcher.nodes, depth);
     }
 
     return res orelse error.NoResultFound;
 }
 
 const Searcher = struct {
+    engine: *Engine,
     timer: *Timer(),
+    limits: *const Limits,
+    // nodes searched by the previous iterations
+    prev_nodes: usize,
     start_depth: i32,
     last_move: Move,
     nodes: usize,
     qnodes: usize,
+    // only used when making moves in place, one undo per move on the
+    // current line
+    undos: [UNDO_STACK_SIZE]board.Undo,
+    undo_len: usize,
 
-    fn init(timer: *Timer(), start_depth: i32) Searcher {
+    fn init(engine: *Engine, timer: *Timer(), limits: *const Limits, prev_nodes: usize, start_depth: i32) Searcher {
         return Searcher{
+            .engine = engine,
             .timer = timer,
+            .limits = limits,
+            .prev_nodes = prev_nodes,
             .start_depth = start_depth,
             .last_move = undefined,
             .nodes = 0,
             .qnodes = 0,
+            .undos = undefined,
+            .undo_len = 0,
         };
     }
 
+    // returns the position after m, which is next when copying or b itself
+    // (until unmake is called) when making in place
+    inline fn make(self: *Searcher, b: *Board, next: *Board, m: Move) *Board {
+        switch (board.make_mode) {
+            .copy => {
+                b.copy_make(next, m);
+                return next;
+            },
+            .unmake => {
+                self.undos[self.undo_len] = b.make(m);
+                self.undo_len += 1;
+                return b;
+            },
+        }
+    }
+
+    inline fn unmake(self: *Searcher, b: *Board, m: Move) void {
+        if (comptime board.make_mode == .copy) return;
+        self.undo_len -= 1;
+        b.unmake(m, self.undos[self.undo_len]);
+    }
+
+    // compiles to nothing unless tracing is built in, and is just a null
+    // check until a trace file is set
+    inline fn trace_node(
+        self: *const Searcher,
+        kind: trace.NodeKind,
+        depth: i32,
+        alpha: i32,
+        beta: i32,
+        score: i32,
+        score_type: tt.ScoreType,
+        best_move: ?Move,
+        tt_hit: bool,
+        cutoff: ?usize,
+    ) void {
+        if (comptime !trace.enabled) return;
+        const recorder = self.engine.tracer orelse return;
+        recorder.record(trace.Record.new(kind, self.ply(depth), depth, alpha, beta, score, score_type, best_move, tt_hit, cutoff));
+    }
+
     inline fn ply(self: *const Searcher, depth: i32) i32 {
         return self.start_depth - depth;
     }
 
     inline fn is_out_of_time(self: *Searcher) !bool {
         // TODO check this optimisation - when to read timer
-        return (0xFFF & (self.nodes + self.qnodes) == 0) and try self.timer.elapsed_ns() / std.time.ns_per_ms > TIMEOUT_MS;
+        const nodes = self.nodes + self.qnodes;
+        if (0xFFF & nodes != 0) return false;
+
+        // another thread can ask the engine to stop at any time
+        if (self.engine.stop.load(.monotonic)) return true;
+        if (self.limits.nodes) |max_nodes| if (self.prev_nodes + nodes >= max_nodes) return true;
+
+        return try self.timer.elapsed_ns() / std.time.ns_per_ms > self.limits.movetime_ms;
     }
 };
 
 // s is a *Searcher
-fn root_search(s: *Searcher, pv: *PV, b: *const Board, alpha: i32, beta: i32, depth: i32) !SearchResult {
+fn root_search(s: *Searcher, pv: *PV, root: *const Board, alpha: i32, beta: i32, depth: i32) !SearchResult {
     var a = alpha;
 
+    // search a copy, so running out of time part way down a line when making
+    // in place doesn't leave the uci board with the line still on it
+    var pos = root.*;
+    const b = &pos;
+
     const checked = b.is_in_check();
-    var ml = movegen.MoveList.new(b, pv.get_move(s.ply(depth)));
-    movegen.gen_moves(&ml, checked);
+    var ml = movegen.MoveList.new(b, pv.get_move(s.ply(depth)), s.engine.tt.get_best_move(b.hash));
+    movegen.gen_moves(&ml);
 
     var best_score: ?i32 = null;
     var best_move: ?Move = null;
@@ -93,20 +192,27 @@ fn root_search(s: *Searcher, pv: *PV, b: *const Board, alpha: i32, beta: i32, de
     var node_pv = PV.init();
 
     var has_moved = false;
+    var searched: usize = 0;
+    var cutoff: ?usize = null;
     var next: Board = undefined;
     while (ml.next()) |m| {
-        b.copy_make(&next, m);
-        movegen.push_repetition(b.hash);
-        if (!movegen.is_legal_move(&next, m, checked)) {
-            movegen.pop_repetition(b.hash);
+        s.engine.reps.push(b.hash);
+        // running out of time unwinds straight past the pop below
+        errdefer s.engine.reps.pop(b.hash);
+        const child = s.make(b, &next, m);
+        if (s.engine.reps.is_draw(child)) {
+            s.unmake(b, m);
+            s.engine.reps.pop(b.hash);
             continue;
         }
 
         has_moved = true;
+        searched += 1;
 
         s.last_move = m;
-        const score = -try alpha_beta_search(s, &node_pv, &next, -beta, -a, depth - 1);
-        movegen.pop_repetition(b.hash);
+        const score = -try alpha_beta_search(s, &node_pv, child, -beta, -a, depth - 1);
+        s.unmake(b, m);
+        s.engine.reps.pop(b.hash);
 
         if (score > best_score orelse -eval.INF) {
             best_score = score;
@@ -119,6 +225,7 @@ fn root_search(s: *Searcher, pv: *PV, b: *const Board, alpha: i32, beta: i32, de
         }
         if (score >= beta) {
             score_type = .Beta;
+            cutoff = searched - 1;
 
             break;
         }
@@ -136,7 +243,8 @@ fn root_search(s: *Searcher, pv: *PV, b: *const Board, alpha: i32, beta: i32, de
 
     if (best_score == null) return error.FailLow;
 
-    tt.set_entry(b.hash, best_score.?, score_type, depth, s.ply(depth), best_move.?);
+    s.trace_node(.root, depth, alpha, beta, best_score.?, score_type, best_move, false, cutoff);
+    s.engine.tt.set_entry(b.hash, best_score.?, score_type, depth, s.ply(depth), best_move.?);
     return SearchResult{ .score = best_score.?, .move = best_move.? };
 }
 
@@ -152,15 +260,27 @@ fn alpha_beta_search(s: *Searcher, pv: *PV, b: *Board, alpha: i32, beta: i32, de
         return val;
     }
 
-    if (tt.get_score(b.hash, alpha, beta, depth, s.ply(depth))) |score| {
+    if (s.engine.tt.get_score(b.hash, alpha, beta, depth, s.ply(depth))) |score| {
+        s.trace_node(.main, depth, alpha, beta, score, .None, null, true, null);
         return score;
     }
 
     const checked = b.is_in_check();
-    var ml = movegen.MoveList.new(b, pv.get_move(s.ply(depth)));
-    movegen.gen_moves(&ml, checked);
+
+    // nothing either side does changes the result, so there's no point
+    // searching it. positions in check are still searched, so that a mate
+    // on the board is never scored as a draw
+    if (!checked and endgame.known_draw(b)) {
+        s.trace_node(.main, depth, alpha, beta, endgame.DRAW, .PV, null, false, null);
+        return endgame.DRAW;
+    }
+
+    var ml = movegen.MoveList.new(b, pv.get_move(s.ply(depth)), s.engine.tt.get_best_move(b.hash));
+    movegen.gen_moves(&ml);
 
     var has_moved = false;
+    var searched: usize = 0;
+    var cutoff: ?usize = null;
     var node_pv = PV.init();
     var next: Board = undefined;
 
@@ -168,19 +288,34 @@ fn alpha_beta_search(s: *Searcher, pv: *PV, b: *Board, alpha: i32, beta: i32, de
     var best_move: ?Move = null;
     var score_type: tt.ScoreType = .Alpha;
     while (ml.next()) |m| {
-        b.copy_make(&next, m);
-        movegen.push_repetition(b.hash);
+        // see needs the position before the move, which is gone once the
+        // move is made in place
+        const hangs = has_moved and quiet_hangs(b, m, checked, depth);
 
-        if (!movegen.is_legal_move(&next, m, checked)) {
-            movegen.pop_repetition(b.hash);
+        s.engine.reps.push(b.hash);
+        errdefer s.engine.reps.pop(b.hash);
+        const child = s.make(b, &next, m);
+
+        if (s.engine.reps.is_draw(child)) {
+            s.unmake(b, m);
+            s.engine.reps.pop(b.hash);
+            continue;
+        }
+
+        // unless it gives check
+        if (hangs and !child.is_in_check()) {
+            s.unmake(b, m);
+            s.engine.reps.pop(b.hash);
             continue;
         }
 
         has_moved = true;
+        searched += 1;
 
         s.last_move = m;
-        const score = -try alpha_beta_search(s, &node_pv, &next, -beta, -a, depth - 1);
-        movegen.pop_repetition(b.hash);
+        const score = -try alpha_beta_search(s, &node_pv, child, -beta, -a, depth - 1);
+        s.unmake(b, m);
+        s.engine.reps.pop(b.hash);
 
         if (score > best_score) {
             best_score = score;
@@ -196,6 +331,7 @@ fn alpha_beta_search(s: *Searcher, pv: *PV, b: *Board, alpha: i32, beta: i32, de
         if (score >= beta) {
             best_score = beta;
             score_type = .Beta;
+            cutoff = searched - 1;
             break;
         }
     }
@@ -205,51 +341,103 @@ fn alpha_beta_search(s: *Searcher, pv: *PV, b: *Board, alpha: i32, beta: i32, de
         best_score = (if (checked) -eval.CHECKMATE else eval.STALEMATE) + s.ply(depth);
     }
 
-    tt.set_entry(b.hash, best_score, score_type, depth, s.ply(depth), best_move);
+    s.trace_node(.main, depth, alpha, beta, best_score, score_type, best_move, false, cutoff);
+    s.engine.tt.set_entry(b.hash, best_score, score_type, depth, s.ply(depth), best_move);
     return best_score;
 }
 
-fn quiesce_search(s: *Searcher, b: *const Board, alpha: i32, beta: i32, depth: i32) !i32 {
+// near the leaves a quiet move that just hangs material is almost never
+// the best move, as long as it isn't a check (which the caller checks after
+// making the move)
+fn quiet_hangs(b: *const Board, m: Move, checked: bool, depth: i32) bool {
+    if (checked or depth > SEE_QUIET_PRUNE_DEPTH) return false;
+    if (m.mt.is_cap() or m.mt.is_promo()) return false;
+
+    return !eval.see_ge(b, m, -SEE_QUIET_MARGIN * depth, null);
+}
+
+fn quiesce_search(s: *Searcher, b: *Board, alpha: i32, beta: i32, depth: i32) !i32 {
     s.qnodes += 1;
     if (try s.is_out_of_time()) return error.OutOfTime;
 
+    const checked = b.is_in_check();
+    const tt_depth: i32 = if (checked) QS_TT_DEPTH_CHECKED else QS_TT_DEPTH;
+    if (s.engine.tt.get_score(b.hash, alpha, beta, tt_depth, s.ply(depth))) |score| {
+        s.trace_node(.qsearch, depth, alpha, beta, score, .None, null, true, null);
+        return score;
+    }
+
     var a = alpha;
-    var val = eval.eval(b);
+    var val: i32 = -eval.INF;
+    var maps: ?movegen.AttackMaps = null;
 
-    if (val >= beta) return val;
+    // there is no standing pat when in check, every evasion has to be tried
+    if (!checked) {
+        val = eval.lazy_eval(b, a, beta, &maps);
 
-    if (!b.is_in_endgame()) {
-        const promo_val = if (s.last_move.mt.is_promo()) eval.QUEEN_VALUE - 200 else 0;
-        const delta = eval.QUEEN_VALUE + promo_val;
-        if (val < a - delta) return a;
-    }
+        if (val >= beta) {
+            s.trace_node(.qsearch, depth, alpha, beta, val, .Beta, null, false, null);
+            return val;
+        }
 
-    if (a < val) a = val;
+        if (!b.is_in_endgame()) {
+            const promo_val = if (s.last_move.mt.is_promo()) eval.QUEEN_VALUE - 200 else 0;
+            const delta = eval.QUEEN_VALUE + promo_val;
+            if (val < a - delta) {
+                s.trace_node(.qsearch, depth, alpha, beta, a, .Alpha, null, false, null);
+                return a;
+            }
+        }
 
-    var ml = movegen.MoveList.new(b, null);
-    movegen.gen_q_moves(&ml);
+        if (a < val) a = val;
+    }
+
+    var ml = movegen.MoveList.new(b, null, s.engine.tt.get_best_move(b.hash));
+    if (maps) |*m| ml.maps = m;
+    if (checked) movegen.gen_moves(&ml) else movegen.gen_q_moves(&ml);
 
+    var has_moved = false;
+    var searched: usize = 0;
+    var cutoff: ?usize = null;
+    var best_move: ?Move = null;
+    var score_type: tt.ScoreType = .Alpha;
     var next: Board = undefined;
     while (ml.next_scored()) |next_move| {
-        // skip if SEE is negative, if this is negative then the
-        // remaining moves will also be bad
-        if (next_move.score - eval.CAP_MOVE_SCORE < 0) break;
-
-        if (next_move.move.xpiece == .KING or next_move.move.xpiece == .KING_B) {
-            // TODO This isn't quite checkmate, as there could be
-            // quiet moves that could have escaped it
-            return eval.CHECKMATE - s.ply(depth);
-        }
+        // captures that fail see_ge are moved below CAP_MOVE_SCORE by the
+        // move list, so once one is reached the rest are all bad too
+        if (!checked and next_move.score - eval.CAP_MOVE_SCORE < 0) break;
 
-        b.copy_make(&next, next_move.move);
+        const child = s.make(b, &next, next_move.move);
+        has_moved = true;
+        searched += 1;
 
         s.last_move = next_move.move;
-        const score = -try quiesce_search(s, &next, -beta, -a, depth - 1);
+        const score = -try quiesce_search(s, child, -beta, -a, depth - 1);
+        s.unmake(b, next_move.move);
 
-        if (score >= beta) return score;
-        if (score > val) val = score;
-        if (score > a) a = score;
+        if (score > val) {
+            val = score;
+            best_move = next_move.move;
+        }
+
+        if (score > a) {
+            a = score;
+            score_type = .PV;
+        }
+
+        if (score >= beta) {
+            score_type = .Beta;
+            cutoff = searched - 1;
+            break;
+        }
+    }
+
+    if (checked and !has_moved) {
+        val = -eval.CHECKMATE + s.ply(depth);
+        score_type = .PV;
     }
 
+    s.trace_node(.qsearch, depth, alpha, beta, val, score_type, best_move, false, cutoff);
+    s.engine.tt.set_entry(b.hash, val, score_type, tt_depth, s.ply(depth), best_move);
     return val;
 }
@@ -8,6 +8,7 @@ const util = @import("util.zig");
 const search = @import("search.zig");
 const tt = @import("tt.zig");
 const UCI = @import("uci.zig").UCI;
+const Engine = @import("engine.zig").Engine;
 // const ZigTimer = @import("timer.zig").ZigTimer;
 const Timer = @import("timer.zig").Timer;
 
@@ -22,7 +23,7 @@ const EpdMoveType = enum {
     fn eq_movegen(self: EpdMoveType, m: MoveType) bool {
         return switch (self) {
             .Quiet => switch (m) {
-                .QUIET, .DOUBLE, .PROMO => true,
+                .QUIET, .DOUBLE, .NPROMO, .RPROMO, .BPROMO, .QPROMO => true,
                 else => false,
             },
             .Cap => switch (m) {
@@ -125,7 +126,7 @@ fn parse_epd(allocator: std.mem.Allocator, str: []const u8) !EPD {
     };
 }
 
-fn epd_search(allocator: std.mem.Allocator, epd: EPD) !bool {
+fn epd_search(allocator: std.mem.Allocator, engine: *Engine, epd: EPD) !bool {
     std.log.info("trying {s}: ", .{epd.id});
     epd.pos.log(std.log.debug);
     for (epd.bms) |bm| {
@@ -144,10 +145,10 @@ fn epd_search(allocator: std.mem.Allocator, epd: EPD) !bool {
     var buf: [1024]u8 = undefined;
     var writer = stdout.writer(&buf);
 
-    var uci = try UCI.init(allocator, &writer.interface, epd.pos);
+    var uci = try UCI.init(allocator, &writer.interface, engine, epd.pos);
     defer uci.deinit(allocator);
 
-    const res = search.do_search(uci) catch |err| {
+    const res = search.do_search(uci, .{}) catch |err| {
         switch (err) {
             error.NoResultFound => std.log.err("{s} position failed low!", .{epd.id}),
             else => std.log.err("{s} unexpected error: {s}", .{ epd.id, @errorName(err) }),
@@ -159,7 +160,7 @@ fn epd_search(allocator: std.mem.Allocator, epd: EPD) !bool {
     var found_bm = false;
     for (epd.bms) |bm| {
         var matches = true;
-        if (res.move.piece != bm.piece) matches = false;
+        if (res.move.moved_piece(&epd.pos) != bm.piece) matches = false;
         if (res.move.to != bm.to) matches = false;
         if (!bm.mt.eq_movegen(res.move.mt)) matches = false;
 
@@ -191,6 +192,9 @@ pub fn main() !void {
     defer arena.deinit();
     const allocator = arena.allocator();
 
+    const engine = try Engine.init(std.heap.page_allocator, tt.DEFAULT_TT_MB);
+    defer engine.deinit();
+
     var args = try std.process.argsWithAllocator(allocator);
 
     _ = args.next();
@@ -199,7 +203,7 @@ pub fn main() !void {
 
     if (std.mem.eql(u8, filename, "pos")) {
         const epd = try parse_epd(allocator, args.next() orelse usage_and_die());
-        const passed = try epd_search(allocator, epd);
+        const passed = try epd_search(allocator, engine, epd);
         std.log.info("{s} {s}", .{ epd.id, if (passed) "passed" else "failed" });
         return;
     }
@@ -224,11 +228,11 @@ pub fn main() !void {
             continue;
         }
         const epd = try parse_epd(allocator, line);
-        const passed = try epd_search(allocator, epd);
+        const passed = try epd_search(allocator, engine, epd);
         if (passed) passed_count += 1 else failed_count += 1;
         std.log.info("{s} {s}", .{ epd.id, if (passed) "passed" else "failed" });
 
-        tt.clear();
+        engine.tt.clear();
 
         if (end) |e| if (count >= e) break;
         count += 1;
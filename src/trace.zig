@@ -0,0 +1,202 @@
+const std = @import("std");
+const config = @import("config");
+
+const movegen = @import("movegen.zig");
+const Move = movegen.Move;
+const tt = @import("tt.zig");
+
+// records a line per node searched to a file for trace_analyzer, only
+// compiled in with -Dtrace=true and only running once a file has been set
+// (setoption name TraceFile value <path>)
+pub const enabled = config.trace;
+
+pub const MAGIC = "CRTR".*;
+pub const VERSION: u32 = 1;
+
+pub const NodeKind = enum(u8) { root, main, qsearch };
+
+// cutoff when the node didn't fail high
+pub const NO_CUTOFF = std.math.maxInt(u16);
+
+// the file is a Header followed by Records, all in the native byte order
+pub const Header = extern struct {
+    magic: [4]u8 = MAGIC,
+    version: u32 = VERSION,
+    record_size: u32 = @sizeOf(Record),
+};
+
+pub const Record = extern struct {
+    alpha: i32,
+    beta: i32,
+    score: i32,
+    // the best move as a u16, Move.NONE if there wasn't one
+    move: u16,
+    ply: u16,
+    // qsearch depth counts down from 0
+    depth: i16,
+    // the index (in search order) of the move that failed high
+    cutoff: u16,
+    kind: NodeKind,
+    // a tt.ScoreType
+    score_type: u8,
+    tt_hit: bool,
+    _pad: u8 = 0,
+
+    pub fn new(
+        kind: NodeKind,
+        ply: i32,
+        depth: i32,
+        alpha: i32,
+        beta: i32,
+        score: i32,
+        score_type: tt.ScoreType,
+        best_move: ?Move,
+        tt_hit: bool,
+        cutoff: ?usize,
+    ) Record {
+        return .{
+            .alpha = alpha,
+            .beta = beta,
+            .score = score,
+            .move = @bitCast(best_move orelse Move.NONE),
+            .ply = @intCast(ply),
+            .depth = @intCast(depth),
+            .cutoff = if (cutoff) |c| @intCast(@min(c, NO_CUTOFF - 1)) else NO_CUTOFF,
+            .kind = kind,
+            .score_type = @intFromEnum(score_type),
+            .tt_hit = tt_hit,
+        };
+    }
+};
+
+comptime {
+    std.debug.assert(@sizeOf(Record) == 24);
+}
+
+const RING_SIZE = 1 << 16;
+
+// single producer (the search thread) and single consumer (the writer
+// thread), when the writer falls behind records are dropped rather than
+// making the search wait
+const Ring = struct {
+    records: [RING_SIZE]Record,
+    // only the search thread moves head, only the writer moves tail
+    head: std.atomic.Value(usize),
+    tail: std.atomic.Value(usize),
+    dropped: usize,
+
+    fn push(self: *Ring, r: Record) void {
+        const head = self.head.load(.monotonic);
+        if (head - self.tail.load(.acquire) == RING_SIZE) {
+            @branchHint(.unlikely);
+            self.dropped += 1;
+            return;
+        }
+
+        self.records[head % RING_SIZE] = r;
+        self.head.store(head + 1, .release);
+    }
+
+    // the records ready to be written, only up to the end of the buffer so
+    // there may be more after these have been consumed
+    fn readable(self: *Ring) []const Record {
+        const tail = self.tail.load(.monotonic);
+        const head = self.head.load(.acquire);
+        const start = tail % RING_SIZE;
+        const len = @min(head - tail, RING_SIZE - start);
+        return self.records[start .. start + len];
+    }
+
+    fn consume(self: *Ring, len: usize) void {
+        self.tail.store(self.tail.load(.monotonic) + len, .release);
+    }
+};
+
+// one per search thread, owns the ring and the thread writing it out
+pub const Recorder = struct {
+    allocator: std.mem.Allocator,
+    ring: *Ring,
+    file: std.fs.File,
+    thread: std.Thread,
+    running: std.atomic.Value(bool),
+
+    pub fn start(allocator: std.mem.Allocator, path: []const u8) !*Recorder {
+        const r = try allocator.create(Recorder);
+        errdefer allocator.destroy(r);
+
+        const ring = try allocator.create(Ring);
+        errdefer allocator.destroy(ring);
+        ring.head = std.atomic.Value(usize).init(0);
+        ring.tail = std.atomic.Value(usize).init(0);
+        ring.dropped = 0;
+
+        const file = try std.fs.cwd().createFile(path, .{});
+        errdefer file.close();
+
+        r.* = .{
+            .allocator = allocator,
+            .ring = ring,
+            .file = file,
+            .thread = undefined,
+            .running = std.atomic.Value(bool).init(true),
+        };
+        r.thread = try std.Thread.spawn(.{}, write_loop, .{r});
+
+        return r;
+    }
+
+    // writes out everything recorded so far and closes the file
+    pub fn stop(self: *Recorder) void {
+        self.running.store(false, .release);
+        self.thread.join();
+
+        if (self.ring.dropped > 0) {
+            std.log.warn("trace writer fell behind, dropped {d} records", .{self.ring.dropped});
+        }
+
+        self.file.close();
+        self.allocator.destroy(self.ring);
+        self.allocator.destroy(self);
+    }
+
+    pub inline fn record(self: *Recorder, r: Record) void {
+        self.ring.push(r);
+    }
+
+    fn write_loop(self: *Recorder) void {
+        var buf: [1 << 16]u8 = undefined;
+        var fw = self.file.writer(&buf);
+        const w = &fw.interface;
+
+        self.write_records(w) catch |err| {
+            std.log.err("trace writer stopped: {s}", .{@errorName(err)});
+            // keep emptying the ring so the search never notices
+            while (self.running.load(.acquire)) {
+                self.ring.consume(self.ring.readable().len);
+                std.Thread.sleep(std.time.ns_per_ms);
+            }
+        };
+    }
+
+    fn write_records(self: *Recorder, w: *std.Io.Writer) !void {
+        try w.writeAll(std.mem.asBytes(&Header{}));
+
+        while (true) {
+            // read running first, anything pushed before stop is then
+            // guaranteed to be seen below
+            const running = self.running.load(.acquire);
+            const records = self.ring.readable();
+
+            if (records.len == 0) {
+                if (!running) break;
+                std.Thread.sleep(std.time.ns_per_ms);
+                continue;
+            }
+
+            try w.writeAll(std.mem.sliceAsBytes(records));
+            self.ring.consume(records.len);
+        }
+
+        try w.flush();
+    }
+};
@@ -0,0 +1,167 @@
+const std = @import("std");
+
+const trace = @import("trace.zig");
+const Record = trace.Record;
+
+// summarises a trace file recorded by a -Dtrace=true build
+// run with `zig build trace -- <trace file>`
+
+const MAX_PLY = 512;
+const MAX_QS_DEPTH = 64;
+
+// a ply with this many qsearch nodes per full width node is called out
+const EXPLOSION_RATIO = 8;
+
+// cutoff indices are grouped as 0, 1, 2, 3, 4-7, 8-15, 16+
+const CUTOFF_BUCKETS = [_][]const u8{ "1st", "2nd", "3rd", "4th", "5-8th", "9-16th", "17th+" };
+
+const PlyStats = struct {
+    main: usize = 0,
+    qsearch: usize = 0,
+    tt_hits: usize = 0,
+    cutoffs: usize = 0,
+    first_cutoffs: usize = 0,
+};
+
+const Summary = struct {
+    records: usize = 0,
+    max_ply: usize = 0,
+    plies: [MAX_PLY]PlyStats = [_]PlyStats{.{}} ** MAX_PLY,
+    cutoff_buckets: [CUTOFF_BUCKETS.len]usize = [_]usize{0} ** CUTOFF_BUCKETS.len,
+    // how far below the horizon qsearch went, the last bucket is anything deeper
+    qs_depths: [MAX_QS_DEPTH + 1]usize = [_]usize{0} ** (MAX_QS_DEPTH + 1),
+
+    fn add(self: *Summary, r: Record) void {
+        self.records += 1;
+        const ply = @min(@as(usize, r.ply), MAX_PLY - 1);
+        self.max_ply = @max(self.max_ply, ply);
+        const ps = &self.plies[ply];
+
+        switch (r.kind) {
+            .root, .main => ps.main += 1,
+            .qsearch => {
+                ps.qsearch += 1;
+                self.qs_depths[@min(@abs(r.depth), MAX_QS_DEPTH)] += 1;
+            },
+        }
+
+        if (r.tt_hit) ps.tt_hits += 1;
+
+        if (r.cutoff != trace.NO_CUTOFF) {
+            ps.cutoffs += 1;
+            if (r.cutoff == 0) ps.first_cutoffs += 1;
+            self.cutoff_buckets[cutoff_bucket(r.cutoff)] += 1;
+        }
+    }
+
+    fn write(self: *const Summary, w: *std.Io.Writer) !void {
+        var main: usize = 0;
+        var qsearch: usize = 0;
+        for (self.plies[0 .. self.max_ply + 1]) |ps| {
+            main += ps.main;
+            qsearch += ps.qsearch;
+        }
+
+        try w.print("{d} nodes: {d} full width, {d} qsearch ({d:.1}%)\n\n", .{
+            self.records,
+            main,
+            qsearch,
+            percent(qsearch, self.records),
+        });
+
+        try w.print("{s:>4} {s:>12} {s:>12} {s:>8} {s:>8} {s:>10}\n", .{ "ply", "full width", "qsearch", "tt hit", "cutoff", "1st cut" });
+        for (self.plies[0 .. self.max_ply + 1], 0..) |ps, ply| {
+            const nodes = ps.main + ps.qsearch;
+            if (nodes == 0) continue;
+            try w.print("{d:>4} {d:>12} {d:>12} {d:>7.1}% {d:>7.1}% {d:>9.1}%\n", .{
+                ply,
+                ps.main,
+                ps.qsearch,
+                percent(ps.tt_hits, nodes),
+                percent(ps.cutoffs, nodes),
+                percent(ps.first_cutoffs, ps.cutoffs),
+            });
+        }
+
+        var cutoffs: usize = 0;
+        for (self.cutoff_buckets) |c| cutoffs += c;
+
+        try w.print("\ncutoffs by move searched ({d} total)\n", .{cutoffs});
+        for (CUTOFF_BUCKETS, self.cutoff_buckets) |name, c| {
+            try w.print("{s:>6} {d:>12} {d:>6.1}%\n", .{ name, c, percent(c, cutoffs) });
+        }
+
+        try w.print("\nqsearch nodes by depth below the horizon\n", .{});
+        for (self.qs_depths, 0..) |c, d| {
+            if (c == 0) continue;
+            const plus = if (d == MAX_QS_DEPTH) "+" else " ";
+            try w.print("{d:>5}{s} {d:>12} {d:>6.1}%\n", .{ d, plus, c, percent(c, qsearch) });
+        }
+
+        try w.print("\nqsearch explosions (more than {d} qsearch nodes per full width node)\n", .{EXPLOSION_RATIO});
+        var any = false;
+        for (self.plies[0 .. self.max_ply + 1], 0..) |ps, ply| {
+            if (ps.qsearch <= EXPLOSION_RATIO * ps.main) continue;
+            any = true;
+            try w.print("ply {d}: {d} qsearch nodes from {d} full width\n", .{ ply, ps.qsearch, ps.main });
+        }
+        if (!any) try w.print("none\n", .{});
+    }
+};
+
+fn cutoff_bucket(idx: u16) usize {
+    return switch (idx) {
+        0...3 => idx,
+        4...7 => 4,
+        8...15 => 5,
+        else => 6,
+    };
+}
+
+fn percent(n: usize, total: usize) f64 {
+    if (total == 0) return 0;
+    return 100 * @as(f64, @floatFromInt(n)) / @as(f64, @floatFromInt(total));
+}
+
+fn read_trace(r: *std.Io.Reader, summary: *Summary) !void {
+    var header: trace.Header = undefined;
+    try r.readSliceAll(std.mem.asBytes(&header));
+    if (!std.mem.eql(u8, &header.magic, &trace.MAGIC)) return error.NotATraceFile;
+    if (header.version != trace.VERSION or header.record_size != @sizeOf(Record)) {
+        return error.UnsupportedTraceVersion;
+    }
+
+    var record: Record = undefined;
+    while (true) {
+        r.readSliceAll(std.mem.asBytes(&record)) catch |err| switch (err) {
+            // a trace cut off mid record (eg. the engine was killed) is
+            // still worth summarising
+            error.EndOfStream => return,
+            else => return err,
+        };
+        summary.add(record);
+    }
+}
+
+pub fn main() !void {
+    var it = std.process.args();
+    _ = it.skip();
+    const path = it.next() orelse return error.NoTraceFileArg;
+
+    const file = try std.fs.cwd().openFile(path, .{});
+    defer file.close();
+
+    var rbuf: [1 << 16]u8 = undefined;
+    var reader = file.reader(&rbuf);
+
+    const summary = try std.heap.page_allocator.create(Summary);
+    defer std.heap.page_allocator.destroy(summary);
+    summary.* = .{};
+    try read_trace(&reader.interface, summary);
+
+    var stdout = std.fs.File.stdout();
+    var wbuf: [4096]u8 = undefined;
+    var writer = stdout.writer(&wbuf);
+    try summary.write(&writer.interface);
+    try writer.interface.flush();
+}
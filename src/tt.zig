@@ -5,7 +5,8 @@ const Board = board.Board;
 const Colour = board.Colour;
 const Piece = board.Piece;
 const CastleState = board.CastleState;
-const Move = @import("movegen.zig").Move;
+const movegen = @import("movegen.zig");
+const Move = movegen.Move;
 const zobrist = @import("consts").zobrist;
 const search = @import("search.zig");
 const eval = @import("eval.zig");
@@ -56,38 +57,48 @@ pub fn hash_board(b: *const Board) u64 {
     return hash;
 }
 
-pub const TT_SIZE: usize = 1 << 20;
-pub const TT_MASK: usize = TT_SIZE - 1;
+pub const DEFAULT_TT_MB: usize = 64;
 
-pub const ScoreType = enum { PV, Alpha, Beta };
+// None marks an empty slot, so entries don't need to be optional
+pub const ScoreType = enum(u2) { None, PV, Alpha, Beta };
+
+// depth, age and score type share 16 bits so that an entry is exactly 16 bytes
+const EntryInfo = packed struct(u16) { depth: i10, age: u4, score_type: ScoreType };
 
 // TODO maybe store just ply instead of depth?
-pub const TTEntry = struct { hash: u64, score: i32, score_type: ScoreType, depth: i32, best_move: ?Move };
+pub const TTEntry = struct {
+    hash: u64,
+    score: i32,
+    // Move.NONE if there is no best move
+    best_move: Move,
+    info: EntryInfo,
+
+    const EMPTY = TTEntry{
+        .hash = 0,
+        .score = 0,
+        .best_move = Move.NONE,
+        .info = .{ .depth = 0, .age = 0, .score_type = .None },
+    };
 
-var tt_data: [TT_SIZE]?TTEntry = [_]?TTEntry{null} ** TT_SIZE;
+    pub inline fn depth(self: TTEntry) i32 {
+        return self.info.depth;
+    }
 
-pub fn clear() void {
-    @memset(&tt_data, null);
-}
+    pub inline fn score_type(self: TTEntry) ScoreType {
+        return self.info.score_type;
+    }
 
-pub fn exists(hash: u64) bool {
-    const e = tt_data[hash & TT_MASK] orelse return false;
-    return e.hash == hash;
-}
+    pub inline fn is_empty(self: TTEntry) bool {
+        return self.info.score_type == .None;
+    }
 
-pub fn get_best_move(hash: u64) ?Move {
-    const e = tt_data[hash & TT_MASK] orelse return null;
-    if (e.hash != hash) return null;
-    return e.best_move;
-}
+    inline fn get_best_move(self: TTEntry) ?Move {
+        return if (movegen.moves_eq(self.best_move, Move.NONE)) null else self.best_move;
+    }
+};
 
-pub fn get_pv_move(hash: u64) ?Move {
-    const e = tt_data[hash & TT_MASK] orelse return null;
-    if (e.hash != hash) return null;
-    return switch (e.score_type) {
-        .PV => e.best_move,
-        else => null,
-    };
+comptime {
+    std.debug.assert(@sizeOf(TTEntry) == 16);
 }
 
 fn adjust_in(score: i32, ply: i32) i32 {
@@ -114,38 +125,101 @@ fn adjust_out(score: i32, ply: i32) i32 {
     return score;
 }
 
-// For perft
-pub fn get_entry(hash: u64, depth: i32) ?TTEntry {
-    const e = tt_data[hash & TT_MASK] orelse return null;
-    if (e.hash != hash or e.depth != depth) return null;
+// a transposition table owns its own entries so that several can live in the
+// same process, the size is rounded down to a power of two number of entries
+pub const TT = struct {
+    entries: []TTEntry,
+    mask: usize,
+    // bumped by new_search, entries left from older searches can still be
+    // probed but are always replaced
+    age: u4,
 
-    return e;
-}
+    pub fn init(allocator: std.mem.Allocator, size_mb: usize) !TT {
+        const bytes = @max(size_mb, 1) * 1024 * 1024;
+        const count = std.math.floorPowerOfTwo(usize, bytes / @sizeOf(TTEntry));
 
-pub fn get_score(hash: u64, alpha: i32, beta: i32, depth: i32, ply: i32) ?i32 {
-    const e = tt_data[hash & TT_MASK] orelse return null;
-    if (e.hash != hash or e.depth < depth) return null;
+        const entries = try allocator.alloc(TTEntry, count);
+        @memset(entries, TTEntry.EMPTY);
 
-    // TODO returning alpha/beta or e.score in a fail?
-    return switch (e.score_type) {
-        .PV => adjust_out(e.score, ply),
-        .Alpha => if (alpha < e.score) adjust_out(alpha, ply) else null,
-        .Beta => if (beta >= e.score) adjust_out(beta, ply) else null,
-    };
-}
+        return TT{ .entries = entries, .mask = count - 1, .age = 0 };
+    }
 
-pub fn set_entry(hash: u64, score: i32, score_type: ScoreType, depth: i32, ply: i32, best_move: ?Move) void {
-    const existing = tt_data[hash & TT_MASK];
-    if (existing) |e| if (e.depth > depth) return;
+    pub fn deinit(self: *TT, allocator: std.mem.Allocator) void {
+        allocator.free(self.entries);
+    }
 
-    tt_data[hash & TT_MASK] = TTEntry{
-        .hash = hash,
-        .score = adjust_in(score, ply),
-        .score_type = score_type,
-        .depth = depth,
-        .best_move = best_move,
-    };
-}
+    pub fn clear(self: *TT) void {
+        @memset(self.entries, TTEntry.EMPTY);
+        self.age = 0;
+    }
+
+    // keeps the table warm for a search of a related position, instead of
+    // clearing it
+    pub fn new_search(self: *TT) void {
+        self.age +%= 1;
+    }
+
+    // returns the entry for hash if the slot holds that position
+    inline fn probe(self: *const TT, hash: u64) ?TTEntry {
+        const e = self.entries[hash & self.mask];
+        if (e.is_empty() or e.hash != hash) return null;
+        return e;
+    }
+
+    pub fn exists(self: *const TT, hash: u64) bool {
+        return self.probe(hash) != null;
+    }
+
+    pub fn get_best_move(self: *const TT, hash: u64) ?Move {
+        const e = self.probe(hash) orelse return null;
+        return e.get_best_move();
+    }
+
+    pub fn get_pv_move(self: *const TT, hash: u64) ?Move {
+        const e = self.probe(hash) orelse return null;
+        return switch (e.score_type()) {
+            .PV => e.get_best_move(),
+            else => null,
+        };
+    }
+
+    // For perft
+    pub fn get_entry(self: *const TT, hash: u64, depth: i32) ?TTEntry {
+        const e = self.probe(hash) orelse return null;
+        if (e.depth() != depth) return null;
+
+        return e;
+    }
+
+    pub fn get_score(self: *const TT, hash: u64, alpha: i32, beta: i32, depth: i32, ply: i32) ?i32 {
+        const e = self.probe(hash) orelse return null;
+        if (e.depth() < depth) return null;
+
+        // TODO returning alpha/beta or e.score in a fail?
+        const score = adjust_out(e.score, ply);
+        return switch (e.score_type()) {
+            .PV => score,
+            // the stored score is an upper bound, only usable if it fails low
+            .Alpha => if (score <= alpha) alpha else null,
+            // the stored score is a lower bound, only usable if it fails high
+            .Beta => if (score >= beta) beta else null,
+            .None => unreachable,
+        };
+    }
+
+    pub fn set_entry(self: *TT, hash: u64, score: i32, score_type: ScoreType, depth: i32, ply: i32, best_move: ?Move) void {
+        std.debug.assert(score_type != .None);
+        const existing = self.entries[hash & self.mask];
+        if (!existing.is_empty() and existing.info.age == self.age and existing.depth() > depth) return;
+
+        self.entries[hash & self.mask] = TTEntry{
+            .hash = hash,
+            .score = adjust_in(score, ply),
+            .best_move = best_move orelse Move.NONE,
+            .info = .{ .depth = @intCast(depth), .age = self.age, .score_type = score_type },
+        };
+    }
+};
 
 pub const PV = struct {
     moves: [search.MAX_DEPTH]Move,
@@ -9,31 +9,184 @@ const movegen = @import("movegen.zig");
 const Move = movegen.Move;
 const eval = @import("eval.zig");
 const Timer = @import("timer.zig").Timer;
+const Engine = @import("engine.zig").Engine;
+const trace = @import("trace.zig");
+const mate_search = @import("mate.zig");
 
 const BOT_NAME = "crig";
 const AUTHOR = "George Bull";
+const MAX_HASH_MB = 4096;
+const MAX_GAME_PLIES = 1024;
 
 const UciCommand = enum(usize) {
     uci,
     //TODO debug
     isready,
-    //TODO setoption
+    setoption,
     ucinewgame,
     position,
     go,
-    //TODO stop
+    // stop is handled as soon as it is read, see read_lines
     //TODO ponderhit
     quit,
 };
 
+// a snapshot of a finished iteration, passed to the info listener
+pub const SearchInfo = struct {
+    depth: usize,
+    score: i32,
+    // mate in moves, negative if mated, null if not a mate score
+    mate: ?i32,
+    time_ms: u64,
+    nodes: usize,
+    nps: u64,
+    pv: *const PV,
+};
+
+// the game set up by the last position command, kept so that a position
+// command that only adds moves to it (as guis send every turn) doesn't have
+// to replay the whole game, and so the search sees the game's repetitions
+const GameHistory = struct {
+    start: Board,
+    moves: [MAX_GAME_PLIES]Move,
+    // hashes[i] is the position before moves[i], hashes[len] is the
+    // current position
+    hashes: [MAX_GAME_PLIES + 1]u64,
+    len: usize,
+
+    fn reset(self: *GameHistory, start: Board) void {
+        self.start = start;
+        self.hashes[0] = start.hash;
+        self.len = 0;
+    }
+
+    fn push(self: *GameHistory, m: Move, hash: u64) !void {
+        if (self.len == MAX_GAME_PLIES) return error.GameTooLong;
+        self.moves[self.len] = m;
+        self.len += 1;
+        self.hashes[self.len] = hash;
+    }
+
+    // the positions since the last capture or pawn move, nothing before
+    // that can come up again
+    fn reversible_hashes(self: *const GameHistory, halfmove: usize) []const u64 {
+        const n = @min(halfmove, self.len);
+        return self.hashes[self.len - n .. self.len + 1];
+    }
+
+    // the moves of a position command left to play after this game's moves,
+    // null if the command doesn't start with them
+    fn remaining_moves(self: *const GameHistory, moves: []const u8) ?[]const u8 {
+        var it = std.mem.tokenizeScalar(u8, moves, ' ');
+        for (self.moves[0..self.len]) |m| {
+            const s = it.next() orelse return null;
+            if (!move_matches(m, s)) return null;
+        }
+        return it.rest();
+    }
+};
+
+fn move_matches(m: Move, s: []const u8) bool {
+    var buf: [5]u8 = undefined;
+    var w = std.Io.Writer.fixed(&buf);
+    m.as_uci_str(&w) catch return false;
+    return std.mem.eql(u8, w.buffered(), s);
+}
+
+// lines read by run's input thread, waiting to be handled
+const LineQueue = struct {
+    allocator: std.mem.Allocator,
+    mutex: std.Thread.Mutex = .{},
+    cond: std.Thread.Condition = .{},
+    lines: std.ArrayList([]u8) = .empty,
+    // the reader has finished, nothing more comes once lines is empty
+    closed: bool = false,
+
+    fn deinit(self: *LineQueue) void {
+        for (self.lines.items) |line| self.allocator.free(line);
+        self.lines.deinit(self.allocator);
+    }
+
+    fn push(self: *LineQueue, line: []const u8) !void {
+        const owned = try self.allocator.dupe(u8, line);
+        errdefer self.allocator.free(owned);
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        try self.lines.append(self.allocator, owned);
+        self.cond.signal();
+    }
+
+    fn close(self: *LineQueue) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.closed = true;
+        self.cond.signal();
+    }
+
+    // blocks until there is a line, null once the reader has finished and
+    // every line has been taken. the caller owns the line
+    fn pop(self: *LineQueue) ?[]u8 {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        while (self.lines.items.len == 0 and !self.closed) self.cond.wait(&self.mutex);
+        if (self.lines.items.len == 0) return null;
+        return self.lines.orderedRemove(0);
+    }
+};
+
+// stop is acted on straight away, everything else is queued for run. quit
+// is queued too, but also stops any search so that it is handled promptly
+fn read_lines(reader: *std.Io.Reader, lines: *LineQueue, engine: *Engine) void {
+    defer lines.close();
+
+    while (reader.takeDelimiterInclusive('\n')) |line| {
+        const input = std.mem.trim(u8, line, " \r\n");
+        if (std.mem.eql(u8, input, "stop")) {
+            engine.stop.store(true, .monotonic);
+            continue;
+        }
+
+        lines.push(line) catch |err| {
+            std.log.err("could not queue input: {s}", .{@errorName(err)});
+            return;
+        };
+
+        if (std.mem.eql(u8, input, "quit")) {
+            engine.stop.store(true, .monotonic);
+            return;
+        }
+    } else |err| switch (err) {
+        error.EndOfStream => {},
+        else => std.log.err("could not read input: {s}", .{@errorName(err)}),
+    }
+}
+
+// lets a host (eg. the jni layer) receive search info as it arrives, on top
+// of the text written to the uci writer
+pub const InfoListener = struct {
+    ctx: *anyopaque,
+    on_info: *const fn (ctx: *anyopaque, info: *const SearchInfo) void,
+};
+
 pub const UCI = struct {
     board: Board,
     last_best_move: ?Move,
     writer: *std.Io.Writer,
+    engine: *Engine,
+    info_listener: ?InfoListener,
+    // set while a host (eg. the jni layer) has a search running on another
+    // thread, nothing else may touch the board until it is cleared
+    searching: std.atomic.Value(bool),
+    game: GameHistory,
+    // the biggest Hash that setoption will accept, hosts running many
+    // sessions (eg. crigd) lower it
+    max_hash_mb: usize,
 
     pub fn init(
         allocator: std.mem.Allocator,
         writer: *std.Io.Writer,
+        engine: *Engine,
         b: Board,
     ) !*UCI {
         const uci = try allocator.create(UCI);
@@ -41,7 +194,13 @@ pub const UCI = struct {
             .board = b,
             .last_best_move = null,
             .writer = writer,
+            .engine = engine,
+            .info_listener = null,
+            .searching = std.atomic.Value(bool).init(false),
+            .game = undefined,
+            .max_hash_mb = MAX_HASH_MB,
         };
+        uci.game.reset(b);
 
         return uci;
     }
@@ -79,56 +238,100 @@ pub const UCI = struct {
     }
 
     pub fn send_info(self: *UCI, res: search.SearchResult, pv: *const PV, timer: *Timer(), nodes: usize, depth: usize) !void {
+        const t_ns = try timer.elapsed_ns();
+        const info = SearchInfo{
+            .depth = depth,
+            .score = res.score,
+            .mate = mate_from_score(res.score),
+            .time_ms = t_ns / std.time.ns_per_ms,
+            .nodes = nodes,
+            .nps = @intFromFloat(nps(t_ns, nodes)),
+            .pv = pv,
+        };
+
+        if (self.info_listener) |listener| listener.on_info(listener.ctx, &info);
+
         try self.writer.print("info depth {d} ", .{depth});
 
-        if (mate_from_score(res.score)) |mate| {
+        if (info.mate) |mate| {
             try self.writer.print("score mate {d} ", .{mate});
         } else {
             try self.writer.print("score cp {d} ", .{res.score});
         }
 
-        const t_ns = try timer.elapsed_ns();
-        const t_ms = t_ns / std.time.ns_per_ms;
-        try self.writer.print("time {d} nodes {d} nps {d} pv ", .{ t_ms, nodes, nps(t_ns, nodes) });
+        try self.writer.print("time {d} nodes {d} nps {d} pv ", .{ info.time_ms, nodes, info.nps });
         try pv.write_pv(self.writer);
         try self.writer.writeByte('\n');
         return self.writer.flush();
     }
 
-    // TODO seems like there are a lack of free's in this
+    // input is read on its own thread so that stop gets through while a
+    // search is running, every other line waits its turn on this thread
     pub fn run(self: *UCI, reader: *std.Io.Reader) !void {
-        // TODO can this run in another thread?
-        while (reader.takeDelimiterInclusive('\n')) |line| {
-            // TODO maybe trim other chars? (\r?)
-            const input = std.mem.trim(u8, line, " \n");
-            try self.log_uci_in(input);
-
-            const cmd = get_uci_command(input) catch {
-                try self.log_uci_error("Unknown command: '{s}'", .{input});
-                continue;
+        const allocator = self.engine.allocator;
+        const lines = try allocator.create(LineQueue);
+        lines.* = .{ .allocator = allocator };
+
+        const reader_thread = std.Thread.spawn(.{}, read_lines, .{ reader, lines, self.engine }) catch |err| {
+            allocator.destroy(lines);
+            return err;
+        };
+
+        while (lines.pop()) |line| {
+            defer allocator.free(line);
+            const keep_going = self.handle_line(line) catch |err| {
+                // the reader could be blocked waiting for input, so it (and
+                // the queue it writes to) is left to go with the process
+                reader_thread.detach();
+                return err;
             };
+            if (!keep_going) break;
+        }
+
+        // the reader stops by itself after quit or the end of the input
+        reader_thread.join();
+        lines.deinit();
+        allocator.destroy(lines);
+    }
+
+    // handles one line of input, returns false once quit has been read
+    pub fn handle_line(self: *UCI, line: []const u8) !bool {
+        // TODO maybe trim other chars? (\r?)
+        const input = std.mem.trim(u8, line, " \n");
+        try self.log_uci_in(input);
 
-            switch (cmd) {
-                .uci => try self.handle_uci(),
-                .isready => try self.handle_isready(),
-                .ucinewgame => self.handle_ucinewgame(),
-                .position => self.handle_position(input) catch |err| {
-                    try self.log_uci_error("Invalid position command '{s}': {s}", .{ input, @errorName(err) });
-                    continue;
-                },
-                .go => try self.handle_go(input),
-                .quit => break,
-            }
-        } else |err| {
-            switch (err) {
-                error.EndOfStream => return,
-                else => return err,
-            }
+        const cmd = get_uci_command(input) catch {
+            try self.log_uci_error("Unknown command: '{s}'", .{input});
+            return true;
+        };
+
+        switch (cmd) {
+            .uci => try self.handle_uci(),
+            .isready => try self.handle_isready(),
+            .setoption => self.handle_setoption(input) catch |err| {
+                try self.log_uci_error("Invalid setoption command '{s}': {s}", .{ input, @errorName(err) });
+            },
+            .ucinewgame => self.handle_ucinewgame(),
+            .position => self.handle_position(input) catch |err| {
+                try self.log_uci_error("Invalid position command '{s}': {s}", .{ input, @errorName(err) });
+            },
+            .go => self.handle_go(input) catch |err| {
+                try self.log_uci_error("Could not run go command '{s}': {s}", .{ input, @errorName(err) });
+                // the gui is still waiting for a bestmove
+                _ = try self.writer.write("bestmove 0000\n");
+                try self.writer.flush();
+            },
+            .quit => return false,
         }
+
+        return true;
     }
 
     fn handle_uci(self: *UCI) !void {
-        try self.writer.print("id name {s}\nid author {s}\nuciok\n", .{ BOT_NAME, AUTHOR });
+        try self.writer.print("id name {s}\nid author {s}\n", .{ BOT_NAME, AUTHOR });
+        try self.writer.print("option name Hash type spin default {d} min 1 max {d}\n", .{ @min(tt.DEFAULT_TT_MB, self.max_hash_mb), self.max_hash_mb });
+        if (comptime trace.enabled) try self.writer.print("option name TraceFile type string default <empty>\n", .{});
+        try self.writer.print("uciok\n", .{});
         return self.writer.flush();
     }
 
@@ -137,37 +340,97 @@ pub const UCI = struct {
         return self.writer.flush();
     }
 
+    // supports "setoption name Hash value <mb>", and in trace builds
+    // "setoption name TraceFile value <path>" (<empty> to stop tracing)
+    pub fn handle_setoption(self: *UCI, input: []const u8) !void {
+        const name_start = (std.mem.indexOf(u8, input, "name ") orelse return error.NoOptionName) + "name ".len;
+        const name_end = std.mem.indexOf(u8, input, " value ") orelse return error.NoOptionValue;
+        const name = std.mem.trim(u8, input[name_start..name_end], " ");
+        const value = std.mem.trim(u8, input[name_end + " value ".len ..], " ");
+
+        if (std.ascii.eqlIgnoreCase(name, "Hash")) {
+            const mb = try std.fmt.parseInt(usize, value, 10);
+            if (mb < 1 or mb > self.max_hash_mb) return error.HashOutOfRange;
+            return self.engine.resize_tt(mb);
+        }
+
+        if (trace.enabled and std.ascii.eqlIgnoreCase(name, "TraceFile")) {
+            const path: ?[]const u8 = if (value.len == 0 or std.mem.eql(u8, value, "<empty>")) null else value;
+            return self.engine.set_trace_file(path);
+        }
+
+        return error.UnknownOption;
+    }
+
     pub fn handle_ucinewgame(self: *UCI) void {
         self.board = board.default_board();
-        movegen.clear_repetitions();
-        tt.clear();
+        self.game.reset(self.board);
+        self.engine.new_game();
     }
 
+    // when the command carries on from the current game only its new moves
+    // are played, otherwise the game is set up again from the start
     pub fn handle_position(self: *UCI, input: []const u8) !void {
-        self.board = pos: {
-            if (std.mem.startsWith(u8, input, "position startpos")) break :pos board.default_board();
-            if (!std.mem.startsWith(u8, input, "position fen")) return error.InvalidPositionCommand;
-            const fen_start = "position fen".len;
-            const fen_end = std.mem.indexOf(u8, input, " moves") orelse input.len;
-            break :pos try board.board_from_fen(input[fen_start..fen_end]);
+        const start = try parse_position_start(input);
+        const moves = position_moves(input) orelse "";
+
+        // the game is built up on the side, so that an illegal move leaves
+        // the current one as it was
+        var game = self.game;
+        var curr = self.board;
+        const new_moves = if (self.continues_game(&start)) self.game.remaining_moves(moves) else null;
+        const to_play = new_moves orelse blk: {
+            curr = start;
+            game.reset(start);
+            break :blk moves;
         };
-        movegen.push_repetition(self.board.hash);
 
-        const moves_start = (std.mem.indexOf(u8, input, " moves ") orelse return) + " moves ".len;
-        self.board = try process_moves(self.board, input[moves_start..]);
+        var it = std.mem.tokenizeScalar(u8, to_play, ' ');
+        while (it.next()) |s| {
+            const m = try movegen.parse_uci_move_legal(curr, s);
+            var next: Board = undefined;
+            curr.copy_make(&next, m);
+            try game.push(m, next.hash);
+            curr = next;
+        }
+
+        self.board = curr;
+        self.game = game;
+        self.sync_reps();
+    }
+
+    // the board could have been set without a position command (eg. by
+    // review), so it has to still be where the game left it
+    fn continues_game(self: *const UCI, start: *const Board) bool {
+        if (self.board.hash != self.game.hashes[self.game.len]) return false;
+        return board.cmp_boards(&self.game.start, start) and self.game.start.halfmove == start.halfmove;
+    }
+
+    fn sync_reps(self: *UCI) void {
+        self.engine.reps.clear();
+        for (self.game.reversible_hashes(self.board.halfmove)) |h| self.engine.reps.push(h);
     }
 
     pub fn handle_go(self: *UCI, input: []const u8) !void {
-        //TODO handle options
-        _ = input;
+        const limits = try parse_go_limits(input, self.board.ctm);
+        self.engine.stop.store(false, .monotonic);
+        return self.search_and_report(limits);
+    }
+
+    // searches the current board and writes the bestmove, does not reset the
+    // engine's stop flag so that a stop sent before the search starts is kept
+    pub fn search_and_report(self: *UCI, limits: search.Limits) !void {
+        // a failed search mustn't leave the last search's move behind
+        self.last_best_move = null;
+        if (limits.mate) |moves| return self.mate_and_report(moves, limits);
 
         // highly likley that there a many positions from the last
         // search that had incomplete bounds when the timer cut off
         // the search, clearing this increases the seach stablilty at
         // the cost of performance
-        tt.clear();
+        self.engine.tt.clear();
 
-        const res = try search.do_search(self);
+        const res = try search.do_search(self, limits);
         self.last_best_move = res.move;
 
         _ = try self.writer.write("bestmove ");
@@ -175,39 +438,135 @@ pub const UCI = struct {
         _ = try self.writer.write("\n");
         return self.writer.flush();
     }
+
+    fn mate_and_report(self: *UCI, moves: usize, limits: search.Limits) !void {
+        var timer = try Timer().init();
+        const res = try mate_search.find_mate(self.engine.allocator, &self.board, moves, &limits, &self.engine.stop);
+        const time_ms = try timer.elapsed_ns() / std.time.ns_per_ms;
+
+        const mate_in = res.mate_in orelse {
+            self.last_best_move = null;
+            try self.writer.print("info nodes {d} time {d} string no mate found within {d}\n", .{ res.nodes, time_ms, moves });
+            _ = try self.writer.write("bestmove 0000\n");
+            return self.writer.flush();
+        };
+
+        self.last_best_move = res.pv.moves[0];
+        try self.writer.print("info depth {d} score mate {d} nodes {d} time {d} pv ", .{ res.pv.len, mate_in, res.nodes, time_ms });
+        try res.pv.write_pv(self.writer);
+        try self.writer.writeByte('\n');
+
+        _ = try self.writer.write("bestmove ");
+        try res.pv.moves[0].as_uci_str(self.writer);
+        _ = try self.writer.write("\n");
+        return self.writer.flush();
+    }
 };
 
 fn nps(time_ns: u64, nodes: usize) f64 {
+    if (time_ns == 0) return 0;
     const n: f64 = @floatFromInt(nodes);
     return std.math.floor((n * @as(f64, @floatFromInt(std.time.ns_per_s))) / @as(f64, @floatFromInt(time_ns)));
 }
 
-// returns mate in however many moves (not plies), negative if mated
-// null if score isn't a mate score
-fn mate_from_score(score: i32) ?i32 {
+// returns mate in however many moves (not plies), negative if mated (0 if
+// already checkmated), null if score isn't a mate score
+pub fn mate_from_score(score: i32) ?i32 {
     if (score >= eval.CHECKMATE - search.MAX_DEPTH) {
         // +3 to the depth: +1 as all checkmates are odd, +2 to make the moves non-zero indexed
         return @divFloor(eval.CHECKMATE - score + 3, 2);
     }
 
     if (score <= -eval.CHECKMATE + search.MAX_DEPTH) {
-        return @divFloor(@as(i32, @intCast(@abs(-eval.CHECKMATE + score))), 2);
+        return -@divFloor(eval.CHECKMATE + score + 1, 2);
     }
 
     return null;
 }
 
+fn parse_go_value(it: *std.mem.SplitIterator(u8, .scalar)) !u64 {
+    const str = it.next() orelse return error.MissingGoValue;
+    return std.fmt.parseInt(u64, str, 10);
+}
+
+// ponder and searchmoves are ignored, go ponder searches like a plain go
+pub fn parse_go_limits(input: []const u8, ctm: board.Colour) !search.Limits {
+    var limits = search.Limits{};
+
+    var movetime: ?u64 = null;
+    var time_left: ?u64 = null;
+    var inc: u64 = 0;
+    var movestogo: u64 = 30;
+    var infinite = false;
+
+    var it = std.mem.splitScalar(u8, input, ' ');
+    while (it.next()) |token| {
+        if (std.mem.eql(u8, token, "movetime")) {
+            movetime = try parse_go_value(&it);
+        } else if (std.mem.eql(u8, token, "nodes")) {
+            limits.nodes = @intCast(try parse_go_value(&it));
+        } else if (std.mem.eql(u8, token, "depth")) {
+            limits.depth = @intCast(try parse_go_value(&it));
+        } else if (std.mem.eql(u8, token, "mate")) {
+            limits.mate = @intCast(try parse_go_value(&it));
+        } else if (std.mem.eql(u8, token, if (ctm == .WHITE) "wtime" else "btime")) {
+            time_left = try parse_go_value(&it);
+        } else if (std.mem.eql(u8, token, if (ctm == .WHITE) "winc" else "binc")) {
+            inc = try parse_go_value(&it);
+        } else if (std.mem.eql(u8, token, "movestogo")) {
+            movestogo = @max(try parse_go_value(&it), 1);
+        } else if (std.mem.eql(u8, token, "infinite")) {
+            infinite = true;
+        }
+    }
+
+    if (movetime) |mt| {
+        limits.movetime_ms = mt;
+    } else if (time_left) |t| {
+        // spend an even share of the remaining time plus most of the
+        // increment, keeping a little back for overhead
+        const budget = t / movestogo + inc * 3 / 4;
+        limits.movetime_ms = @min(budget, t -| 50);
+    }
+
+    // nodes, depth or mate on their own should not be cut short by the default timeout
+    if (movetime == null and time_left == null and (limits.nodes != null or limits.depth < search.MAX_DEPTH - 1 or limits.mate != null)) {
+        infinite = true;
+    }
+
+    if (infinite) limits.movetime_ms = std.math.maxInt(u64);
+
+    return limits;
+}
+
 fn get_uci_command(input: []const u8) !UciCommand {
     var it = std.mem.splitScalar(u8, input, ' ');
     const cmd = it.next() orelse return error.InvalidUciCommand;
     if (std.mem.eql(u8, cmd, "uci")) return .uci;
     if (std.mem.eql(u8, cmd, "isready")) return .isready;
+    if (std.mem.eql(u8, cmd, "setoption")) return .setoption;
     if (std.mem.eql(u8, cmd, "ucinewgame")) return .ucinewgame;
     if (std.mem.eql(u8, cmd, "position")) return .position;
     if (std.mem.eql(u8, cmd, "go")) return .go;
+    if (std.mem.eql(u8, cmd, "quit")) return .quit;
     return error.InvalidUciCommand;
 }
 
+// the board a position command starts from, before any of its moves
+pub fn parse_position_start(input: []const u8) !Board {
+    if (std.mem.startsWith(u8, input, "position startpos")) return board.default_board();
+    if (!std.mem.startsWith(u8, input, "position fen")) return error.InvalidPositionCommand;
+    const fen_start = "position fen".len;
+    const fen_end = std.mem.indexOf(u8, input, " moves") orelse input.len;
+    return board.board_from_fen(input[fen_start..fen_end]);
+}
+
+// the moves of a position command, null if it has none
+pub fn position_moves(input: []const u8) ?[]const u8 {
+    const moves_start = (std.mem.indexOf(u8, input, " moves ") orelse return null) + " moves ".len;
+    return input[moves_start..];
+}
+
 // returns the index of badmove, otherwise returns null
 // TODO fen positioning
 pub fn validate_moves(position: []const u8) ?i32 {
@@ -224,14 +583,14 @@ pub fn validate_moves(position: []const u8) ?i32 {
         var next: Board = undefined;
         curr.copy_make(&next, m);
         curr = next;
-        movegen.push_repetition(curr.hash);
         idx += 1;
     }
 
     return null;
 }
 
-pub fn process_moves(b: Board, moves: []const u8) !Board {
+// pushes each new position onto reps when it is given
+pub fn process_moves(b: Board, moves: []const u8, reps: ?*movegen.Repetitions) !Board {
     var it = std.mem.splitScalar(u8, moves, ' ');
     var curr = b;
     while (it.next()) |s| {
@@ -239,7 +598,7 @@ pub fn process_moves(b: Board, moves: []const u8) !Board {
         var next: Board = undefined;
         curr.copy_make(&next, m);
         curr = next;
-        movegen.push_repetition(curr.hash);
+        if (reps) |r| r.push(curr.hash);
     }
 
     return curr;
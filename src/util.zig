@@ -50,27 +50,15 @@ pub fn display_move(m: Move, w: *std.Io.Writer) !void {
     try write_sq(w, @as(usize, m.to));
     try w.print(" ({d})", .{m.to});
 
-    try w.print(", piece: {s}, xpeice {s}, mt: {s}\n", .{
-        @tagName(m.piece),
-        @tagName(m.xpiece),
-        @tagName(m.mt),
-    });
+    try w.print(", mt: {s}\n", .{@tagName(m.mt)});
 }
 
 pub fn move_as_uci_str(m: Move, w: *std.Io.Writer) !void {
     try write_sq(w, @as(usize, m.from));
     try write_sq(w, @as(usize, m.to));
-    switch (m.mt) {
-        MoveType.PROMO => {
-            const xpiece = @as(Piece, m.xpiece);
-            const c = std.ascii.toLower(board.char_from_piece(xpiece));
-            try w.print("{c}", .{c});
-        },
-        MoveType.NPROMOCAP, MoveType.RPROMOCAP, MoveType.BPROMOCAP, MoveType.QPROMOCAP => |mt| {
-            const c = std.ascii.toLower(@tagName(mt)[0]);
-            try w.print("{c}", .{c});
-        },
-        else => {},
+    if (m.mt.is_promo()) {
+        const c = std.ascii.toLower(@tagName(m.mt)[0]);
+        try w.print("{c}", .{c});
     }
 }
 